@@ -0,0 +1,54 @@
+/*
+ * da_trace.h
+ *
+ *	Tracepoints of the reconfigurations done by device_attacher. BPF programs and bpftrace attach to them as
+ *	tracepoint:device_attacher:<event>, see test_scripts/pl_events.bt. Build with CFLAGS_device_attacher.o := -I$(src)
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM device_attacher
+
+#if !defined(_DA_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _DA_TRACE_H
+
+#include <linux/tracepoint.h>
+
+/**
+ * da_reconfig - Swap of the peripheral in the PL, finished or failed.
+ * @from: Previously loaded peripheral ID, 0 if unknown.
+ * @to: New peripheral ID.
+ * @ns: Duration of the swap. From the ID interrupt, if it was not requested through the device attacher.
+ * @err: 0 or the negative error code.
+ * @requested: Requested through the device attacher, otherwise detected by the ID interrupt.
+ * @staged: The bitstream was programmed from the pre-staged copy.
+ */
+TRACE_EVENT(da_reconfig,
+	TP_PROTO(unsigned long from, unsigned long to, u64 ns, int err, bool requested, bool staged),
+	TP_ARGS(from, to, ns, err, requested, staged),
+	TP_STRUCT__entry(
+		__field(unsigned long, from)
+		__field(unsigned long, to)
+		__field(u64, ns)
+		__field(int, err)
+		__field(bool, requested)
+		__field(bool, staged)
+	),
+	TP_fast_assign(
+		__entry->from = from;
+		__entry->to = to;
+		__entry->ns = ns;
+		__entry->err = err;
+		__entry->requested = requested;
+		__entry->staged = staged;
+	),
+	TP_printk("from=%lu to=%lu ns=%llu err=%d requested=%d staged=%d",__entry->from,__entry->to,__entry->ns,
+		__entry->err,__entry->requested,__entry->staged)
+);
+
+#endif /* _DA_TRACE_H */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE da_trace
+#include <trace/define_trace.h>
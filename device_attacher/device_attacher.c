@@ -31,14 +31,113 @@
 #include <linux/of_address.h>
 #include <linux/interrupt.h>
 #include <linux/string.h>
+#include <linux/mutex.h>
+#include <linux/miscdevice.h>
+#include <linux/fpga/fpga-mgr.h>
+#include <linux/list.h>
+#include <linux/wait.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
 
 #include "linux/of_fdt.h"
 #include "linux/firmware.h"
 
+#define CREATE_TRACE_POINTS
+#include "da_trace.h"
+
 static unsigned int id_interrupt = 0;
 static struct resource id_reg_res;
 static void  __iomem *id_reg_base_addr;
 
+// Module parameters
+static bool sim_id_reg = false;
+module_param(sim_id_reg,bool,0444);
+MODULE_PARM_DESC(sim_id_reg,"Simulate the ID register. The reported ID is set by the reconfigure debugfs file or by the fake FPGA manager.");
+
+static u32 sim_id;	// Value of the simulated ID register.
+
+static bool simulate = false;
+module_param(simulate,bool,0444);
+MODULE_PARM_DESC(simulate,"Simulation mode: the PL region is mocked, a swap only waits sim_swap_ms or sim_staged_swap_ms and no overlay is applied.");
+
+static unsigned int sim_swap_ms = 20;
+module_param(sim_swap_ms,uint,0644);
+MODULE_PARM_DESC(sim_swap_ms,"Duration of a simulated swap in ms.");
+
+static unsigned int sim_staged_swap_ms = 5;
+module_param(sim_staged_swap_ms,uint,0644);
+MODULE_PARM_DESC(sim_staged_swap_ms,"Duration of a simulated swap to a pre-staged peripheral in ms.");
+
+static bool mmio_trace = false;
+module_param(mmio_trace,bool,0644);
+MODULE_PARM_DESC(mmio_trace,"Record the accesses of the ID register into the mmio_trace debugfs file.");
+
+/// Number of ID register accesses kept in the trace.
+#define MMIO_TRACE_LEN 256
+
+// Register access types of the trace
+#define MMIO_READ32	0
+#define MMIO_WRITE32	2
+
+// One register access of the trace, in the record format of the device_drivers trace. The peripheral ID of the ID register is 0.
+struct mmio_trace_rec{
+	u64 ns;			// Start of the access.
+	u32 val;		// Value read or written.
+	u32 dur_ns;		// Duration of the access.
+	u16 offset;		// Byte offset of the register.
+	u8 periph_id;
+	u8 op;
+	u32 cpu;
+};
+
+// The ID register is accessed only a few times per swap, a single ring is enough.
+static DEFINE_SPINLOCK(mmio_trace_lock);
+static unsigned int mmio_trace_head;
+static struct mmio_trace_rec mmio_trace_ring[MMIO_TRACE_LEN];
+
+static void mmio_trace_add(int op, u32 val, u64 start_ns)
+{
+	unsigned long flags;
+	struct mmio_trace_rec *rec;
+	u64 now = ktime_get_ns();
+
+	spin_lock_irqsave(&mmio_trace_lock,flags);
+	rec = &mmio_trace_ring[mmio_trace_head++ % MMIO_TRACE_LEN];
+	rec->ns = start_ns;
+	rec->val = val;
+	rec->dur_ns = min_t(u64,now - start_ns,U32_MAX);
+	rec->offset = 0;
+	rec->periph_id = 0;
+	rec->op = op;
+	rec->cpu = smp_processor_id();
+	spin_unlock_irqrestore(&mmio_trace_lock,flags);
+}
+
+/**
+ * da_read_id - Reads the ID register.
+ */
+static inline u32 da_read_id(void)
+{
+	u64 start = mmio_trace ? ktime_get_ns() : 0;
+	u32 id = sim_id_reg ? sim_id : ioread32(id_reg_base_addr);
+
+	if(start) mmio_trace_add(MMIO_READ32,id,start);
+	return id;
+}
+
+/**
+ * da_clear_irq - Clears the interrupt flag of the ID register.
+ */
+static inline void da_clear_irq(void)
+{
+	u64 start = mmio_trace ? ktime_get_ns() : 0;
+
+	if(!sim_id_reg) iowrite32(0,id_reg_base_addr);
+	if(start) mmio_trace_add(MMIO_WRITE32,0,start);
+}
+
 
 static struct workqueue_struct *wq;
 
@@ -47,65 +146,171 @@ static struct workqueue_struct *wq;
 #define __exit
 */
 
+/// Highest peripheral ID, whose overlay and bitstream can be cached.
+#define DA_MAX_ID 8
+
+// Peripherals, that can be requested by name. The index is the value of the ID register.
+struct periph_desc{
+	const char *name;
+};
+static const struct periph_desc periph_table[DA_MAX_ID] = {
+	[1] = {"pwm"},
+	[2] = {"random"},
+	[3] = {"sw"},
+	[4] = {"timer"},
+};
+
+// Bitstream file of the peripheral with ID i+1. Only the names of the bitstreams built for the thesis are known.
+static char *bitstream[DA_MAX_ID-1] = {"my_axi_pwm.bit",NULL,"my_axi_sw.bit"};
+module_param_array(bitstream,charp,NULL,0444);
+MODULE_PARM_DESC(bitstream,"Bitstream files of the peripherals 1,2,..., requested from the firmware loader. Default: my_axi_pwm.bit,,my_axi_sw.bit");
+
+/**
+ * periph_bitstream - Returns the bitstream file name of the given peripheral, or NULL if it is not known.
+ */
+static const char *periph_bitstream(unsigned long id)
+{
+	if(id == 0 || id >= DA_MAX_ID || !bitstream[id-1] || !bitstream[id-1][0]) return NULL;
+	return bitstream[id-1];
+}
+
+// Cached device tree overlay blobs, so that a swap does not have to read them from the file system again.
+struct overlay_cache_entry{
+	void *blob;
+	size_t size;
+};
+static struct overlay_cache_entry overlay_cache[DA_MAX_ID];
+
 static int overlay_id = -1;
+static unsigned long loaded_id = 0;
 static struct device_node *new_node = NULL;
 static void *dev_tree_blob;
-// BOTTOM HALF WORKER
-void load_overlay(struct work_struct* ws)
-{
-	struct firmware *fw;
-	int ret;
-	unsigned long id;
-	char f_name[21];
 
-	// Delete previous overlay
+// Serializes the overlay changes coming from the interrupt and from the userspace requests.
+static DEFINE_MUTEX(load_lock);
+
+/**
+ * remove_overlay - Deletes the currently applied peripheral overlay. Must be called with load_lock held.
+ */
+static void remove_overlay(void)
+{
 	if(overlay_id >=0 ) of_overlay_destroy(overlay_id);
 	if(new_node) {of_node_put(new_node); new_node = NULL;}
 	if(dev_tree_blob) {kfree(dev_tree_blob); dev_tree_blob = NULL;}
+	overlay_id = -1;
+	loaded_id = 0;
 	printk(KERN_DEBUG"Previous overlay deleted\n");
-	// Read device id
-	id= ioread32(id_reg_base_addr);
+}
+
+/**
+ * get_overlay_blob - Copies the overlay of the given peripheral.
+ * @id: Peripheral ID.
+ * @blob: Returns the copy, freed with kfree.
+ * @size: Returns the size of the copy.
+ *
+ * The blob is taken from the cache if possible, otherwise it is requested as dev_<id>.dtbo and cached.
+ */
+static int get_overlay_blob(unsigned long id,void **blob,size_t *size)
+{
+	const struct firmware *fw;
+	char f_name[21];
+
+	if(id < DA_MAX_ID && overlay_cache[id].blob)
+	{
+		*blob = kmemdup(overlay_cache[id].blob,overlay_cache[id].size,GFP_KERNEL);
+		if(!*blob) goto err_nomem;
+		*size = overlay_cache[id].size;
+		return 0;
+	}
 
 	// Create file name from device id
 	snprintf(f_name,21,"dev_%lu.dtbo",id);
 
 	// Request firmware
-	request_firmware((const struct firmware **)&fw,f_name,NULL);
-
-	if(!fw)
+	if(request_firmware(&fw,f_name,NULL) || !fw)
 	{
 		printk(KERN_ERR"Device tree overlay not found.\n");
-		goto err;
+		return -ENOENT;
 	}
 	printk(KERN_DEBUG"Firmware found\n");
 
 	// copy blob
-	dev_tree_blob = kmalloc(fw->size,GFP_KERNEL);
-	if(!dev_tree_blob)
+	*blob = kmemdup(fw->data,fw->size,GFP_KERNEL);
+	if(*blob && id < DA_MAX_ID)
 	{
-		printk(KERN_ERR"No memory for firmware.\n");
-		release_firmware(fw);
-		goto err;
+		overlay_cache[id].blob = kmemdup(fw->data,fw->size,GFP_KERNEL);
+		if(overlay_cache[id].blob) overlay_cache[id].size = fw->size;
 	}
-	memcpy(dev_tree_blob,fw->data,fw->size);
+	*size = fw->size;
 	release_firmware(fw);
+	if(!*blob) goto err_nomem;
+	return 0;
+
+err_nomem:
+	printk(KERN_ERR"No memory for firmware.\n");
+	return -ENOMEM;
+}
 
-	of_fdt_unflatten_tree((unsigned long*)dev_tree_blob,&new_node);
+/**
+ * prepare_overlay - Unflattens the overlay of the given peripheral and resolves its phandles, ready for of_overlay_create.
+ * @id: Peripheral ID.
+ * @blob: Returns the blob, it has to be kept while the node is used.
+ * @node: Returns the detached root node of the overlay.
+ * @size: Returns the size of the blob.
+ */
+static int prepare_overlay(unsigned long id,void **blob,struct device_node **node,size_t *size)
+{
+	int ret;
+
+	*node = NULL;
+	ret = get_overlay_blob(id,blob,size);
+	if(ret) return ret;
 
-	if(!new_node)
+	of_fdt_unflatten_tree((unsigned long*)*blob,node);
+	if(!*node)
 	{
 		printk(KERN_ERR"Cannot unflatten device tree blob.\n");
+		ret = -EINVAL;
 		goto err0;
 	}
-	of_node_set_flag(new_node,OF_DETACHED);
+	of_node_set_flag(*node,OF_DETACHED);
 
 	// Resolve phandles in the new device tree fragment
-	ret = of_resolve_phandles(new_node);
+	ret = of_resolve_phandles(*node);
 	if(ret!=0)
 	{
 		printk(KERN_ERR"Cannot resolve phandles in the device tree fragment.\n");
 		goto err1;
 	}
+	return 0;
+
+err1:
+	of_node_put(*node);
+	*node = NULL;
+err0:
+	kfree(*blob);
+	*blob = NULL;
+	return ret;
+}
+
+static bool prestage_take_overlay(unsigned long id);
+
+/**
+ * apply_overlay - Inserts the overlay of the given peripheral. Must be called with load_lock held, after remove_overlay.
+ * @id: Peripheral ID.
+ *
+ * A pre-staged overlay is used without preparing it again. Returns after the drivers of the new devices are probed.
+ */
+static int apply_overlay(unsigned long id)
+{
+	int ret;
+	size_t size;
+
+	if(!prestage_take_overlay(id))
+	{
+		ret = prepare_overlay(id,&dev_tree_blob,&new_node,&size);
+		if(ret) goto err;
+	}
 
 	printk(KERN_DEBUG"Inserting the new overlay.\n");
 
@@ -114,8 +319,12 @@ void load_overlay(struct work_struct* ws)
 	if(overlay_id < 0)
 	{
 		printk(KERN_ERR"Cannot add device tree overlay.\n");
+		ret = overlay_id;
 		goto err1;
 	}
+	loaded_id = id;
+	// The PL drivers probe asynchronously. The swap is complete, when the device nodes are created.
+	wait_for_device_probe();
 
 	switch(id)
 	{
@@ -130,25 +339,1083 @@ void load_overlay(struct work_struct* ws)
 	default: break;
 	}
 
-	return;
+	return 0;
 
 err1:
 	of_node_put(new_node);
 	new_node = NULL;
-err0:
 	kfree(dev_tree_blob);
 	dev_tree_blob = NULL;
 err:
 	overlay_id = -1;
-	return;
+	return ret;
+}
+
+// Swap latency statistics
+struct swap_stat{
+	u64 count;
+	u64 total_ns;
+	u64 max_ns;
+};
+static struct swap_stat irq_swap_stat;		// From the ID interrupt until the overlay is applied.
+static struct swap_stat request_swap_stat;	// Duration of the swaps requested through the device attacher.
+static struct swap_stat remove_stat, program_stat, apply_stat;	// Phases of the requested swaps.
+static u64 irq_ns;	// Time of the last ID interrupt.
+
+/**
+ * swap_stat_add - Adds the time elapsed since start to the statistics. Must be called with load_lock held.
+ */
+static void swap_stat_add(struct swap_stat *stat,u64 start)
+{
+	u64 ns = ktime_get_ns() - start;
+
+	stat->count++;
+	stat->total_ns += ns;
+	if(ns > stat->max_ns) stat->max_ns = ns;
+}
+
+/******************************************************
+ * ******** Predictive pre-staging of swaps ***********
+ * ****************************************************/
+
+// Module parameters
+static unsigned int prestage_budget_kb = 8192;
+module_param(prestage_budget_kb,uint,0644);
+MODULE_PARM_DESC(prestage_budget_kb,"Memory for the pre-staged bitstreams and overlays in kB, 0 disables pre-staging.");
+
+static unsigned int prestage_idle_ms = 50;
+module_param(prestage_idle_ms,uint,0644);
+MODULE_PARM_DESC(prestage_idle_ms,"Pre-staging starts, when no swap was done for this time.");
+
+/// Transition counts are halved in a row reaching this value, so that the prediction follows the recent pattern.
+#define PRESTAGE_MAX_COUNT 256
+
+// Bitstream and prepared overlay of a peripheral, kept in memory for its next swap. Protected by load_lock.
+struct staged_periph{
+	const struct firmware *fw;	// Bitstream.
+	u64 fw_ns;			// Time of requesting the bitstream.
+	void *blob;			// Overlay blob and its unflattened, resolved tree.
+	struct device_node *node;
+	size_t blob_size;
+	u64 overlay_ns;			// Time of preparing the overlay.
+	bool sim;			// Staged in simulation mode, nothing is read.
+};
+static struct staged_periph staged[DA_MAX_ID];
+static size_t staged_bytes;
+static size_t bitstream_size;	// Size of the last requested bitstream.
+
+// Swap history, protected by load_lock.
+static u32 transitions[DA_MAX_ID][DA_MAX_ID];	// Number of swaps from the row ID to the column ID.
+static unsigned long history_id;		// Last loaded peripheral, kept while the PL is being swapped.
+static unsigned long swap_gen;			// Incremented by every swap.
+
+// Statistics
+struct prestage_stat{
+	u64 swaps;		// Swaps with a known previous peripheral.
+	u64 predicted;		// The next peripheral was predicted right.
+	u64 bitstream_hits;	// The bitstream was programmed from memory.
+	u64 overlay_hits;	// The overlay was applied without preparing it.
+	u64 saved_ns;		// Load times spared by the hits.
+	u64 staged;		// Bitstreams requested in advance.
+	u64 evicted;		// Staged bitstreams dropped unused.
+};
+static struct prestage_stat prestage_stat;
+
+// The staging reads whole bitstreams, it runs on its own workqueue, so that it does not delay the swaps on wq.
+static struct workqueue_struct *prestage_wq;
+void prestage_worker(struct work_struct*);
+DECLARE_DELAYED_WORK(prestage_job,prestage_worker);
+
+/**
+ * prestage_predict - Returns the peripheral most often loaded after the given one, 0 if it is not known.
+ */
+static unsigned long prestage_predict(unsigned long from)
+{
+	unsigned long i, best = 0;
+
+	if(from == 0 || from >= DA_MAX_ID) return 0;
+	for(i=1;i<DA_MAX_ID;i++)
+	{
+		if(i != from && transitions[from][i] > (best ? transitions[from][best] : 0)) best = i;
+	}
+	return best;
+}
+
+/**
+ * prestage_rank - Lists the peripherals loaded after the given one before, most frequent first.
+ * @rank: At least DA_MAX_ID entries. Returns their number.
+ */
+static int prestage_rank(unsigned long from,unsigned long *rank)
+{
+	unsigned long i;
+	int n = 0, j;
+
+	if(from == 0 || from >= DA_MAX_ID) return 0;
+	for(i=1;i<DA_MAX_ID;i++)
+	{
+		if(i == from || !transitions[from][i] || (!simulate && !periph_bitstream(i))) continue;
+		// Insertion sort, there are only a few peripherals.
+		for(j=n;j>0 && transitions[from][rank[j-1]] < transitions[from][i];j--) rank[j] = rank[j-1];
+		rank[j] = i;
+		n++;
+	}
+	return n;
+}
+
+/**
+ * history_add - Records a swap to the given peripheral, and checks the prediction made for it. Must be called with
+ * load_lock held.
+ */
+static void history_add(unsigned long id)
+{
+	unsigned long from = history_id;
+	int i;
+
+	if(id == 0 || id >= DA_MAX_ID || id == from) return;
+	history_id = id;
+	swap_gen++;
+	if(from == 0) return;
+
+	prestage_stat.swaps++;
+	if(prestage_predict(from) == id) prestage_stat.predicted++;
+	if(++transitions[from][id] >= PRESTAGE_MAX_COUNT)
+	{
+		for(i=0;i<DA_MAX_ID;i++) transitions[from][i] /= 2;
+	}
+}
+
+/**
+ * prestage_kick - Restarts the idle time before the next pre-staging.
+ */
+static void prestage_kick(void)
+{
+	if(prestage_budget_kb && prestage_wq) mod_delayed_work(prestage_wq,&prestage_job,msecs_to_jiffies(prestage_idle_ms));
+}
+
+/**
+ * prestage_drop - Frees the staged data of a peripheral. Must be called with load_lock held.
+ */
+static void prestage_drop(unsigned long id)
+{
+	struct staged_periph *sp = &staged[id];
+
+	if(sp->fw)
+	{
+		staged_bytes -= sp->fw->size;
+		release_firmware(sp->fw);
+		sp->fw = NULL;
+	}
+	if(sp->node) {of_node_put(sp->node); sp->node = NULL;}
+	if(sp->blob)
+	{
+		staged_bytes -= sp->blob_size;
+		kfree(sp->blob);
+		sp->blob = NULL;
+	}
+	sp->sim = false;
+}
+
+/**
+ * prestage_take_bitstream - Returns the staged bitstream of the peripheral, or NULL. It stays staged, as the PL is
+ * often swapped back. Must be called with load_lock held.
+ */
+static const struct firmware *prestage_take_bitstream(unsigned long id)
+{
+	if(id >= DA_MAX_ID || !staged[id].fw) return NULL;
+	prestage_stat.bitstream_hits++;
+	prestage_stat.saved_ns += staged[id].fw_ns;
+	return staged[id].fw;
+}
+
+/**
+ * prestage_take_overlay - Moves the staged overlay of the peripheral into dev_tree_blob and new_node. Returns false, if
+ * it is not staged. Must be called with load_lock held.
+ */
+static bool prestage_take_overlay(unsigned long id)
+{
+	struct staged_periph *sp;
+
+	if(id >= DA_MAX_ID || !staged[id].node) return false;
+	sp = &staged[id];
+	dev_tree_blob = sp->blob;
+	new_node = sp->node;
+	staged_bytes -= sp->blob_size;
+	sp->blob = NULL;
+	sp->node = NULL;
+	prestage_stat.overlay_hits++;
+	prestage_stat.saved_ns += sp->overlay_ns;
+	return true;
+}
+
+/**
+ * prestage_sim_swap_ms - Returns the duration of the simulated swap to the peripheral, shorter if it is staged. Must be
+ * called with load_lock held.
+ */
+static unsigned int prestage_sim_swap_ms(unsigned long id)
+{
+	unsigned int ms = min(sim_staged_swap_ms,sim_swap_ms);
+
+	if(id >= DA_MAX_ID || !staged[id].sim) return sim_swap_ms;
+	prestage_stat.bitstream_hits++;
+	prestage_stat.saved_ns += (u64)(sim_swap_ms - ms)*NSEC_PER_MSEC;
+	return ms;
+}
+
+/**
+ * prestage_fetch - Stages the bitstream and the overlay of a peripheral. Must be called with load_lock held, it is
+ * released while the bitstream is read. In simulation mode the peripheral is only marked, see prestage_sim_swap_ms.
+ */
+static int prestage_fetch(unsigned long id)
+{
+	struct staged_periph *sp = &staged[id];
+	const struct firmware *fw;
+	u64 start;
+	int ret;
+
+	if(simulate)
+	{
+		if(!sp->sim) prestage_stat.staged++;
+		sp->sim = true;
+		return 0;
+	}
+
+	if(!sp->fw)
+	{
+		mutex_unlock(&load_lock);
+		start = ktime_get_ns();
+		ret = request_firmware(&fw,periph_bitstream(id),NULL);
+		start = ktime_get_ns() - start;
+		mutex_lock(&load_lock);
+		if(ret)
+		{
+			printk(KERN_ERR"Bitstream %s not found.\n",periph_bitstream(id));
+			return ret;
+		}
+		// Only this worker stages.
+		sp->fw = fw;
+		sp->fw_ns = start;
+		staged_bytes += fw->size;
+		bitstream_size = fw->size;
+		prestage_stat.staged++;
+	}
+
+	// The overlay is applied only after the current one is removed, its resolved phandles cannot collide.
+	if(!sp->node)
+	{
+		start = ktime_get_ns();
+		ret = prepare_overlay(id,&sp->blob,&sp->node,&sp->blob_size);
+		if(ret) return ret;
+		sp->overlay_ns = ktime_get_ns() - start;
+		staged_bytes += sp->blob_size;
+	}
+	return 0;
+}
+
+/**
+ * prestage_evict - Frees the staged data of the peripherals, that are not kept. Must be called with load_lock held.
+ */
+static void prestage_evict(const bool *keep)
+{
+	unsigned long id;
+
+	for(id=0;id<DA_MAX_ID;id++)
+	{
+		if(keep[id] || !(staged[id].fw || staged[id].node || staged[id].sim)) continue;
+		if(staged[id].fw || staged[id].sim) prestage_stat.evicted++;
+		prestage_drop(id);
+	}
+}
+
+/**
+ * prestage_worker - Stages the peripherals most likely loaded after the current one, while they fit in the budget. The
+ * rest of the staged data is freed.
+ */
+void prestage_worker(struct work_struct *ws)
+{
+	unsigned long rank[DA_MAX_ID];
+	bool keep[DA_MAX_ID] = {false};
+	size_t budget = (size_t)prestage_budget_kb*1024;
+	size_t used = 0, size;
+	unsigned long gen, id;
+	int i, n;
+
+	// A swap is in progress, it kicks the worker again.
+	if(!mutex_trylock(&load_lock)) return;
+	gen = swap_gen;
+	n = prestage_rank(history_id,rank);
+	for(i=0;i<n;i++)
+	{
+		id = rank[i];
+		if(!staged[id].fw && !staged[id].sim)
+		{
+			// The bitstreams of the PL have the same size, the last one estimates the next.
+			if(used + bitstream_size > budget) break;
+			if(staged_bytes + bitstream_size > budget) prestage_evict(keep);
+		}
+		if(prestage_fetch(id)) continue;
+		// A swap happened meanwhile, the rank is outdated.
+		if(gen != swap_gen) goto out;
+
+		size = (staged[id].fw ? staged[id].fw->size : 0) + staged[id].blob_size;
+		if(used + size > budget) break;
+		used += size;
+		keep[id] = true;
+	}
+	prestage_evict(keep);
+out:
+	mutex_unlock(&load_lock);
+}
+
+static void sched_resync(void);
+
+// BOTTOM HALF WORKER
+void load_overlay(struct work_struct* ws)
+{
+	unsigned long id;
+	int ret;
+	bool changed = false;
+
+	mutex_lock(&load_lock);
+	// Read device id
+	id= da_read_id();
+
+	// The overlay is already in place, if the swap was requested through the device attacher.
+	if(overlay_id >= 0 && id == loaded_id)
+	{
+		printk(KERN_DEBUG"Overlay of device %lu is already loaded.\n",id);
+		goto out;
+	}
+
+	// Delete previous overlay
+	remove_overlay();
+	changed = true;
+	ret = apply_overlay(id);
+	trace_da_reconfig(history_id,id,ktime_get_ns() - irq_ns,ret,false,false);
+	if(ret == 0)
+	{
+		swap_stat_add(&irq_swap_stat,irq_ns);
+		history_add(id);
+		prestage_kick();
+	}
+out:
+	mutex_unlock(&load_lock);
+	if(changed) sched_resync();
 }
 DECLARE_WORK(load_job,load_overlay);
 
+/******************************************************
+ * ******* Bitstream loading through fpga-manager *****
+ * ****************************************************/
+
+// Module parameters
+static char *fpga_mgr_compatible = "xlnx,zynq-devcfg-1.0";
+module_param(fpga_mgr_compatible,charp,0444);
+MODULE_PARM_DESC(fpga_mgr_compatible,"Compatible string of the device tree node of the FPGA manager used to program the PL.");
+
+static bool fake_fpga_mgr = false;
+module_param(fake_fpga_mgr,bool,0444);
+MODULE_PARM_DESC(fake_fpga_mgr,"Register and use a fake FPGA manager, that accepts and drops every bitstream. For testing without the Zynq PL.");
+
+static struct platform_device *fake_fpga_pdev = NULL;
+static size_t fake_fpga_bytes;
+
+static enum fpga_mgr_states fake_fpga_state(struct fpga_manager *mgr)
+{
+	return FPGA_MGR_STATE_OPERATING;
+}
+
+static int fake_fpga_write_init(struct fpga_manager *mgr, u32 flags, const char *buf, size_t count)
+{
+	fake_fpga_bytes = 0;
+	return 0;
+}
+
+static int fake_fpga_write(struct fpga_manager *mgr, const char *buf, size_t count)
+{
+	fake_fpga_bytes += count;
+	return 0;
+}
+
+static int fake_fpga_write_complete(struct fpga_manager *mgr, u32 flags)
+{
+	printk(KERN_DEBUG"Fake FPGA manager received %zu bytes.\n",fake_fpga_bytes);
+	return 0;
+}
+
+static const struct fpga_manager_ops fake_fpga_ops = {
+	.state = fake_fpga_state,
+	.write_init = fake_fpga_write_init,
+	.write = fake_fpga_write,
+	.write_complete = fake_fpga_write_complete,
+};
+
+/**
+ * da_fpga_mgr_get - Gets exclusive access to the FPGA manager. Release it with fpga_mgr_put.
+ */
+static struct fpga_manager *da_fpga_mgr_get(void)
+{
+	struct fpga_manager *mgr;
+	struct device_node *mgr_node;
+
+	if(fake_fpga_pdev) return fpga_mgr_get(&fake_fpga_pdev->dev);
+
+	mgr_node = of_find_compatible_node(NULL,NULL,fpga_mgr_compatible);
+	if(!mgr_node) return ERR_PTR(-ENODEV);
+	mgr = of_fpga_mgr_get(mgr_node);
+	of_node_put(mgr_node);
+	return mgr;
+}
+
+/**
+ * program_bitstream - Programs the PL with the bitstream of the given peripheral. Must be called with load_lock held.
+ * @id: Peripheral ID, it must have an entry in periph_table.
+ * @written: Set, if the FPGA manager was started, i.e. the previous peripheral is no longer in the PL.
+ */
+static int program_bitstream(unsigned long id,bool *written)
+{
+	int ret;
+	const struct firmware *fw, *staged_fw;
+	struct fpga_manager *mgr;
+
+	*written = false;
+	if(!periph_bitstream(id))
+	{
+		printk(KERN_ERR"No bitstream is given for peripheral %lu, see the bitstream parameter.\n",id);
+		return -ENOENT;
+	}
+
+	mgr = da_fpga_mgr_get();
+	if(IS_ERR(mgr))
+	{
+		printk(KERN_ERR"FPGA manager is not available.\n");
+		return PTR_ERR(mgr);
+	}
+
+	fw = staged_fw = prestage_take_bitstream(id);
+	if(!fw)
+	{
+		ret = request_firmware(&fw,periph_bitstream(id),NULL);
+		if(ret)
+		{
+			printk(KERN_ERR"Bitstream %s not found.\n",periph_bitstream(id));
+			goto out;
+		}
+		bitstream_size = fw->size;
+	}
+
+	*written = true;
+	ret = fpga_mgr_buf_load(mgr,0,fw->data,fw->size);
+	if(ret) printk(KERN_ERR"Cannot program the PL with %s.\n",periph_bitstream(id));
+	if(fw != staged_fw) release_firmware(fw);
+
+	// The new peripheral reports its ID and raises the ID interrupt.
+	if(!ret && sim_id_reg)
+	{
+		sim_id = id;
+		irq_ns = ktime_get_ns();
+		queue_work(wq,&load_job);
+	}
+out:
+	fpga_mgr_put(mgr);
+	return ret;
+}
+
+/**
+ * da_swap - Replaces the peripheral in the PL: programs its bitstream and applies its overlay without waiting for the ID interrupt.
+ * @id: Peripheral ID, it must have an entry in periph_table.
+ *
+ * If the bitstream cannot be read, the overlay of the previous peripheral is applied again. If programming the PL
+ * fails, the region stays empty (loaded_id is 0) and the error is returned to the requesting clients.
+ */
+static int da_swap(unsigned long id)
+{
+	int ret = 0;
+	u64 start, phase;
+	bool staged_hit, written;
+	unsigned long prev_id;
+
+	mutex_lock(&load_lock);
+	if((overlay_id >= 0 || simulate) && id == loaded_id) goto out;
+	start = ktime_get_ns();
+
+	if(simulate)
+	{
+		staged_hit = id < DA_MAX_ID && staged[id].sim;
+		msleep(prestage_sim_swap_ms(id));
+		loaded_id = id;
+		swap_stat_add(&request_swap_stat,start);
+		trace_da_reconfig(history_id,id,ktime_get_ns() - start,0,true,staged_hit);
+		// Nothing is loaded, only the predictions and the pre-staging are simulated.
+		history_add(id);
+		prestage_kick();
+		goto out;
+	}
+
+	// The drivers must release the old peripheral, before it disappears from the PL.
+	prev_id = overlay_id >= 0 ? loaded_id : 0;
+	remove_overlay();
+	swap_stat_add(&remove_stat,start);
+	phase = ktime_get_ns();
+	staged_hit = id < DA_MAX_ID && staged[id].fw;
+	ret = program_bitstream(id,&written);
+	if(ret)
+	{
+		// The old peripheral is still in the PL.
+		if(!written && prev_id && apply_overlay(prev_id) == 0)
+			printk(KERN_ERR"Swap to peripheral %lu failed, peripheral %lu is restored.\n",id,prev_id);
+		else
+			printk(KERN_ERR"Swap to peripheral %lu failed, the PL region is empty.\n",id);
+		goto trace;
+	}
+	swap_stat_add(&program_stat,phase);
+	phase = ktime_get_ns();
+	ret = apply_overlay(id);
+	if(ret) goto trace;
+	swap_stat_add(&apply_stat,phase);
+	swap_stat_add(&request_swap_stat,start);
+trace:
+	trace_da_reconfig(history_id,id,ktime_get_ns() - start,ret,true,staged_hit);
+	if(ret) goto out;
+	history_add(id);
+	prestage_kick();
+out:
+	mutex_unlock(&load_lock);
+	return ret;
+}
+
+/******************************************************
+ * ********** Userspace request interface *************
+ * ****************************************************/
+
+/**
+ * da_parse_id - Converts a peripheral name or ID to a peripheral ID.
+ * @str: Null terminated string.
+ */
+static int da_parse_id(const char *str,unsigned long *id)
+{
+	int i;
+
+	if(kstrtoul(str,10,id) == 0)
+		return (*id > 0 && *id < DA_MAX_ID && periph_table[*id].name) ? 0 : -EINVAL;
+
+	for(i=1;i<DA_MAX_ID;i++)
+	{
+		if(periph_table[i].name && strcmp(str,periph_table[i].name) == 0)
+		{
+			*id = i;
+			return 0;
+		}
+	}
+	return -EINVAL;
+}
+
+/******************************************************
+ * ************ Reconfiguration scheduler *************
+ * ****************************************************/
+
+// Module parameters
+static unsigned int sched_max_batch = 8;
+module_param(sched_max_batch,uint,0644);
+MODULE_PARM_DESC(sched_max_batch,"Maximum number of requests served by one bitstream load, while other peripherals are requested.");
+
+static unsigned int sched_deadline_ms = 1000;
+module_param(sched_deadline_ms,uint,0644);
+MODULE_PARM_DESC(sched_deadline_ms,"A request waiting longer than this forces a swap after the current users of the PL are finished.");
+
+enum da_client_state {DA_IDLE, DA_WAITING, DA_GRANTED, DA_FAILED};
+
+// Per open file data of the request interface. A client holds one request at a time.
+struct da_client{
+	struct list_head node;
+	unsigned long id;
+	u64 submit_ns;
+	enum da_client_state state;
+	int err;
+};
+
+static DEFINE_MUTEX(sched_lock);
+static DECLARE_WAIT_QUEUE_HEAD(sched_wq);
+static LIST_HEAD(sched_queue);		// Waiting clients in submission order.
+static unsigned long sched_id;		// Peripheral currently granted by the scheduler.
+static unsigned long sched_target;	// Peripheral being loaded by sched_job.
+static bool sched_swapping;
+static unsigned int sched_holders;	// Clients using sched_id.
+static unsigned int sched_batch;	// Requests served since the last swap.
+
+void sched_swap_worker(struct work_struct*);
+DECLARE_WORK(sched_job,sched_swap_worker);
+
+// Statistics
+static u64 stat_operations;
+static u64 stat_swaps;
+static u64 stat_wait_ns;
+
+/**
+ * da_grant - Grants the loaded peripheral to a waiting client. Must be called with sched_lock held.
+ */
+static void da_grant(struct da_client *client)
+{
+	list_del(&client->node);
+	client->state = DA_GRANTED;
+	sched_holders++;
+	sched_batch++;
+	stat_operations++;
+	stat_wait_ns += ktime_get_ns() - client->submit_ns;
+}
+
+/**
+ * da_schedule - Serves the waiting clients. Must be called with sched_lock held.
+ *
+ * Requests for the loaded peripheral join the current batch until sched_max_batch requests are served or the oldest
+ * request exceeds sched_deadline_ms, provided that other peripherals are waiting. When the batch is closed and the
+ * current users are finished, the PL is swapped to the peripheral of the oldest request of another type.
+ * Only the peripheral actually loaded is granted, even if the PL was reconfigured without the scheduler.
+ */
+static void da_schedule(void)
+{
+	struct da_client *client, *tmp, *next = NULL;
+	bool others_waiting = false;
+	bool expired = false;
+	unsigned long id;
+
+	if(sched_swapping) return;
+	// The PL was reconfigured outside the scheduler, by the ID interrupt.
+	id = READ_ONCE(loaded_id);
+	if(sched_id != id)
+	{
+		sched_id = id;
+		sched_batch = 0;
+	}
+	if(list_empty(&sched_queue)) return;
+
+	list_for_each_entry(client,&sched_queue,node)
+	{
+		if(client->id != sched_id)
+		{
+			others_waiting = true;
+			break;
+		}
+	}
+	// Only an expired request of an other peripheral closes the batch. An expired request of the loaded peripheral is
+	// granted even over sched_max_batch, otherwise the PL would swap away from it.
+	client = list_first_entry(&sched_queue,struct da_client,node);
+	if(ktime_get_ns() - client->submit_ns > (u64)sched_deadline_ms*NSEC_PER_MSEC)
+	{
+		if(client->id != sched_id) expired = true;
+		else if(sched_id) da_grant(client);
+	}
+
+	// Extend the batch of the loaded peripheral.
+	if(sched_id && !(others_waiting && expired))
+	{
+		list_for_each_entry_safe(client,tmp,&sched_queue,node)
+		{
+			if(others_waiting && sched_batch >= sched_max_batch) break;
+			if(client->id == sched_id) da_grant(client);
+		}
+	}
+
+	// Swap, when the loaded peripheral is no longer used.
+	if(sched_holders > 0 || list_empty(&sched_queue)) return;
+	list_for_each_entry(client,&sched_queue,node)
+	{
+		if(client->id != sched_id)
+		{
+			next = client;
+			break;
+		}
+	}
+	if(!next) next = list_first_entry(&sched_queue,struct da_client,node);
+
+	sched_target = next->id;
+	sched_swapping = true;
+	queue_work(wq,&sched_job);
+}
+
+// Loads the peripheral selected by da_schedule.
+void sched_swap_worker(struct work_struct *ws)
+{
+	int ret;
+	bool changed;
+	struct da_client *client, *tmp;
+
+	changed = loaded_id != sched_target;
+	ret = da_swap(sched_target);
+
+	mutex_lock(&sched_lock);
+	sched_swapping = false;
+	if(ret)
+	{
+		// Fail every request of the peripheral, that could not be loaded.
+		list_for_each_entry_safe(client,tmp,&sched_queue,node)
+		{
+			if(client->id != sched_target) continue;
+			list_del(&client->node);
+			client->state = DA_FAILED;
+			client->err = ret;
+		}
+		sched_id = 0;
+	}
+	else
+	{
+		if(changed) stat_swaps++;
+		sched_id = sched_target;
+		sched_batch = 0;
+	}
+	da_schedule();
+	mutex_unlock(&sched_lock);
+	wake_up_all(&sched_wq);
+}
+
+/**
+ * sched_resync - Lets the scheduler follow a reconfiguration, that it did not request.
+ */
+static void sched_resync(void)
+{
+	mutex_lock(&sched_lock);
+	da_schedule();
+	mutex_unlock(&sched_lock);
+	wake_up_all(&sched_wq);
+}
+
+/**
+ * da_release_client - Gives back the peripheral held by the client, or withdraws its waiting request.
+ */
+static void da_release_client(struct da_client *client)
+{
+	mutex_lock(&sched_lock);
+	if(client->state == DA_WAITING) list_del(&client->node);
+	else if(client->state == DA_GRANTED) sched_holders--;
+	client->state = DA_IDLE;
+	da_schedule();
+	mutex_unlock(&sched_lock);
+	wake_up_all(&sched_wq);
+}
+
+static int da_open(struct inode *inode, struct file *pfile)
+{
+	struct da_client *client;
+
+	client = kzalloc(sizeof(struct da_client),GFP_KERNEL);
+	if(!client) return -ENOMEM;
+	INIT_LIST_HEAD(&client->node);
+	client->state = DA_IDLE;
+	pfile->private_data = client;
+	return 0;
+}
+
+static int da_close(struct inode *inode, struct file *pfile)
+{
+	struct da_client *client = pfile->private_data;
+
+	da_release_client(client);
+	kfree(client);
+	return 0;
+}
+
+/**
+ * da_read - Returns the name of the loaded peripheral.
+ */
+static ssize_t da_read(struct file *pfile, char __user *buff, size_t count, loff_t *ppos)
+{
+	char str[16];
+	int len;
+	unsigned long id;
+	const char *name = "none";
+
+	id = loaded_id;
+	if(id < DA_MAX_ID && periph_table[id].name) name = periph_table[id].name;
+	len = snprintf(str,16,"%s\n",name);
+	return simple_read_from_buffer(buff,count,ppos,str,len);
+}
+
+/**
+ * da_write - Requests a peripheral, e.g. "sw" or "3", and waits until it is loaded and granted to the client.
+ *
+ * The peripheral is held until the next request, until "done" is written or the file is closed.
+ */
+static ssize_t da_write(struct file *pfile, const char __user *buff, size_t count, loff_t *ppos)
+{
+	char str[16];
+	char *req;
+	int len;
+	int ret;
+	unsigned long id;
+	struct da_client *client = pfile->private_data;
+
+	len = count>15?15:count;
+	if(copy_from_user(str,buff,len)) return -EFAULT;
+	str[len] = 0;
+	req = strim(str);
+
+	// Give back the previous peripheral.
+	da_release_client(client);
+	if(strcmp(req,"done") == 0) return count;
+
+	ret = da_parse_id(req,&id);
+	if(ret) return ret;
+
+	// Submit the request.
+	mutex_lock(&sched_lock);
+	client->id = id;
+	client->submit_ns = ktime_get_ns();
+	client->state = DA_WAITING;
+	list_add_tail(&client->node,&sched_queue);
+	da_schedule();
+	mutex_unlock(&sched_lock);
+
+	ret = wait_event_interruptible(sched_wq,client->state != DA_WAITING);
+	if(ret)
+	{
+		da_release_client(client);
+		return ret;
+	}
+	if(client->state == DA_FAILED)
+	{
+		client->state = DA_IDLE;
+		return client->err;
+	}
+	return count;
+}
+
+static const struct file_operations da_fops = {
+	.owner = THIS_MODULE,
+	.open = da_open,
+	.release = da_close,
+	.read = da_read,
+	.write = da_write,
+	.llseek = no_llseek,
+};
+
+static struct miscdevice da_miscdev = {
+	.minor = MISC_DYNAMIC_MINOR,
+	.name = "device_attacher",
+	.fops = &da_fops,
+};
+
+static struct dentry *da_debugfs;
+
+irqreturn_t da_int_handler(int irq,void *devid);
+
+static int sched_stats_show(struct seq_file *s, void *unused)
+{
+	u64 ops, swaps, wait_ns;
+
+	mutex_lock(&sched_lock);
+	ops = stat_operations;
+	swaps = stat_swaps;
+	wait_ns = stat_wait_ns;
+	mutex_unlock(&sched_lock);
+
+	seq_printf(s,"operations: %llu\n",ops);
+	seq_printf(s,"swaps: %llu\n",swaps);
+	// Fixed point with 3 decimals.
+	seq_printf(s,"swaps_per_operation: %llu.%03llu\n",ops ? div64_u64(swaps,ops) : 0,ops ? div64_u64(swaps*1000,ops)%1000 : 0);
+	seq_printf(s,"mean_wait_us: %llu\n",ops ? div64_u64(wait_ns,ops*NSEC_PER_USEC) : 0);
+	return 0;
+}
+
+static int sched_stats_open(struct inode *inode, struct file *pfile)
+{
+	return single_open(pfile,sched_stats_show,NULL);
+}
+
+static const struct file_operations sched_stats_fops = {
+	.owner = THIS_MODULE,
+	.open = sched_stats_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static void swap_stat_print(struct seq_file *s,const char *name,struct swap_stat *stat)
+{
+	seq_printf(s,"%-10s %8llu %10llu %10llu\n",name,stat->count,
+			stat->count ? div64_u64(stat->total_ns,stat->count*NSEC_PER_USEC) : 0,div_u64(stat->max_ns,NSEC_PER_USEC));
+}
+
+static int swap_stats_show(struct seq_file *s, void *unused)
+{
+	mutex_lock(&load_lock);
+	seq_printf(s,"%-10s %8s %10s %10s\n","swap","count","avg_us","max_us");
+	swap_stat_print(s,"interrupt",&irq_swap_stat);
+	swap_stat_print(s,"request",&request_swap_stat);
+	swap_stat_print(s,"remove",&remove_stat);
+	swap_stat_print(s,"program",&program_stat);
+	swap_stat_print(s,"apply",&apply_stat);
+	mutex_unlock(&load_lock);
+	return 0;
+}
+
+static int swap_stats_open(struct inode *inode, struct file *pfile)
+{
+	return single_open(pfile,swap_stats_show,NULL);
+}
+
+static const struct file_operations swap_stats_fops = {
+	.owner = THIS_MODULE,
+	.open = swap_stats_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static int prestage_stats_show(struct seq_file *s, void *unused)
+{
+	struct prestage_stat *st = &prestage_stat;
+	unsigned long i, j;
+
+	mutex_lock(&load_lock);
+	seq_printf(s,"swaps: %llu\n",st->swaps);
+	seq_printf(s,"predicted: %llu\n",st->predicted);
+	// Fixed point with 3 decimals.
+	seq_printf(s,"hit_rate: %llu.%03llu\n",st->swaps ? div64_u64(st->predicted,st->swaps) : 0,
+			st->swaps ? div64_u64(st->predicted*1000,st->swaps)%1000 : 0);
+	seq_printf(s,"bitstream_hits: %llu\n",st->bitstream_hits);
+	seq_printf(s,"overlay_hits: %llu\n",st->overlay_hits);
+	seq_printf(s,"saved_us: %llu\n",div_u64(st->saved_ns,NSEC_PER_USEC));
+	seq_printf(s,"saved_us_per_swap: %llu\n",st->swaps ? div64_u64(st->saved_ns,st->swaps*NSEC_PER_USEC) : 0);
+	seq_printf(s,"staged: %llu\n",st->staged);
+	seq_printf(s,"evicted: %llu\n",st->evicted);
+	seq_printf(s,"staged_kb: %zu\n",staged_bytes/1024);
+	seq_printf(s,"budget_kb: %u\n",prestage_budget_kb);
+
+	// Staged peripherals and the transition history.
+	seq_printf(s,"staged_now:");
+	for(i=1;i<DA_MAX_ID;i++)
+	{
+		if(staged[i].fw || staged[i].sim) seq_printf(s," %s%s",periph_table[i].name,staged[i].node ? "+overlay" : "");
+	}
+	seq_printf(s,"\n");
+	for(i=1;i<DA_MAX_ID;i++)
+	{
+		if(!periph_table[i].name) continue;
+		seq_printf(s,"after %s:",periph_table[i].name);
+		for(j=1;j<DA_MAX_ID;j++)
+		{
+			if(transitions[i][j]) seq_printf(s," %s=%u",periph_table[j].name,transitions[i][j]);
+		}
+		seq_printf(s,"\n");
+	}
+	mutex_unlock(&load_lock);
+	return 0;
+}
+
+static int prestage_stats_open(struct inode *inode, struct file *pfile)
+{
+	return single_open(pfile,prestage_stats_show,NULL);
+}
+
+/**
+ * prestage_stats_write - Resets the statistics. The transition history is kept.
+ */
+static ssize_t prestage_stats_write(struct file *pfile, const char __user *buff, size_t count, loff_t *ppos)
+{
+	mutex_lock(&load_lock);
+	memset(&prestage_stat,0,sizeof(prestage_stat));
+	mutex_unlock(&load_lock);
+	return count;
+}
+
+static const struct file_operations prestage_stats_fops = {
+	.owner = THIS_MODULE,
+	.open = prestage_stats_open,
+	.read = seq_read,
+	.write = prestage_stats_write,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+// Trace copied at the open of the mmio_trace file.
+struct mmio_trace_dump{
+	size_t len;
+	struct mmio_trace_rec rec[MMIO_TRACE_LEN];
+};
+
+/**
+ * mmio_trace_open - Copies the ID register trace in time order.
+ */
+static int mmio_trace_open(struct inode *inode, struct file *pfile)
+{
+	unsigned int i, n;
+	struct mmio_trace_dump *dump;
+
+	if(!(pfile->f_mode & FMODE_READ)) return 0;
+	dump = kmalloc(sizeof(*dump),GFP_KERNEL);
+	if(!dump) return -ENOMEM;
+	spin_lock_irq(&mmio_trace_lock);
+	n = min_t(unsigned int,mmio_trace_head,MMIO_TRACE_LEN);
+	for(i=0;i<n;i++) dump->rec[i] = mmio_trace_ring[(mmio_trace_head - n + i) % MMIO_TRACE_LEN];
+	spin_unlock_irq(&mmio_trace_lock);
+	dump->len = n;
+	pfile->private_data = dump;
+	return 0;
+}
+
+static ssize_t mmio_trace_read(struct file *pfile, char __user *buff, size_t count, loff_t *ppos)
+{
+	struct mmio_trace_dump *dump = pfile->private_data;
+
+	return simple_read_from_buffer(buff,count,ppos,dump->rec,dump->len * sizeof(dump->rec[0]));
+}
+
+/**
+ * mmio_trace_write - Any write clears the trace.
+ */
+static ssize_t mmio_trace_write(struct file *pfile, const char __user *buff, size_t count, loff_t *ppos)
+{
+	spin_lock_irq(&mmio_trace_lock);
+	mmio_trace_head = 0;
+	spin_unlock_irq(&mmio_trace_lock);
+	return count;
+}
+
+static int mmio_trace_release(struct inode *inode, struct file *pfile)
+{
+	kfree(pfile->private_data);
+	return 0;
+}
+
+static const struct file_operations mmio_trace_fops = {
+	.owner = THIS_MODULE,
+	.open = mmio_trace_open,
+	.read = mmio_trace_read,
+	.write = mmio_trace_write,
+	.llseek = default_llseek,
+	.release = mmio_trace_release,
+};
+
+/**
+ * reconfigure_write - Simulates a reconfiguration: sets the ID reported by the simulated ID register, and raises the ID
+ * interrupt. With the real ID register, only the ID check is started.
+ */
+static ssize_t reconfigure_write(struct file *pfile, const char __user *buff, size_t count, loff_t *ppos)
+{
+	char str[16];
+	int len;
+	unsigned long id;
+
+	len = count>15?15:count;
+	if(copy_from_user(str,buff,len)) return -EFAULT;
+	str[len] = 0;
+	if(kstrtoul(strim(str),10,&id)) return -EINVAL;
+
+	if(sim_id_reg) sim_id = id;
+	da_int_handler(0,NULL);
+	return count;
+}
+
+static const struct file_operations reconfigure_fops = {
+	.owner = THIS_MODULE,
+	.write = reconfigure_write,
+};
+
 // TOP HALF INTERRUPT HANDLER
 irqreturn_t da_int_handler(int irq,void *devid)
 {
+	irq_ns = ktime_get_ns();
 	// Unset irq flag
-	iowrite32(0,id_reg_base_addr);
+	da_clear_irq();
 	// Starting workqueue, that loads the matching overlay.
 	queue_work(wq,&load_job);
 	return IRQ_HANDLED;
@@ -165,14 +1432,15 @@ static short startup_check = 0;
 module_param(startup_check,short,0644);
 MODULE_PARM_DESC(startup_check,"In case of not 0 value the device ID is read after the succesfull module loading.");
 
-static int  da_init(void)
+/**
+ * id_reg_init - Loads the overlay of the ID register, maps it and registers the ID interrupt handler.
+ */
+static int id_reg_init(void)
 {
 	int retval;
 	struct firmware *id_fw;
 	struct device_node *id_node;
 
-	printk(KERN_INFO"Device attacher module started.\n");
-
 	printk(KERN_DEBUG"Loading device tree overlay of the id register.\n");
 	request_firmware_direct(&id_fw,"axi_id_reg.dtbo",NULL);
 	if(!id_fw)
@@ -252,32 +1520,17 @@ static int  da_init(void)
 		goto err4;
 	}
 
-	// Initializing workqueue.
-	wq = create_workqueue("Device Attacher workqueue");
-	if(!wq)
-	{
-		printk(KERN_ERR"Cannot create workqueue.\n");
-		goto err5;
-	}
-
 	// Register handler to the interrupt line.
 	if(request_irq(id_interrupt, da_int_handler,0,"Device Attacher",NULL))
 	{
 		printk(KERN_ERR"Interrupt line occupied.\n");
-		goto err6;
+		goto err5;
 	}
 
-	printk(KERN_INFO"Device Attacher loaded successfully.\n");
 	of_node_put(id_node);
-
-	// If startup_check module parameter is not 0, perform the ID check.
-	if(startup_check != 0)
-		queue_work(wq,&load_job);
 	return 0;
 
 
-	err6:
-		destroy_workqueue(wq);
 	err5:
 		iounmap(id_reg_base_addr);
 	err4:
@@ -294,20 +1547,127 @@ static int  da_init(void)
 		return -EFAULT;
 }
 
-static void __exit  da_exit(void)
+/**
+ * id_reg_exit - Releases the resources allocated by id_reg_init, except the interrupt line.
+ */
+static void id_reg_exit(void)
 {
-	// Delete current device tree overlay
-	if(overlay_id >= 0) of_overlay_destroy(overlay_id);
-	if(new_node) {of_node_put(new_node);}
-	if(dev_tree_blob) kfree(dev_tree_blob);
-
-	free_irq(id_interrupt,NULL);
-	destroy_workqueue(wq);
 	iounmap(id_reg_base_addr);
 	release_mem_region(id_reg_res.start,resource_size(&id_reg_res));
 	of_overlay_destroy(id_reg_overlay_id);
 	of_node_put(overlay_node);
 	if(id_blob) kfree(id_blob);
+}
+
+static int  da_init(void)
+{
+	int retval;
+
+	printk(KERN_INFO"Device attacher module started.\n");
+
+	// Initializing workqueue.
+	wq = create_workqueue("Device Attacher workqueue");
+	if(!wq)
+	{
+		printk(KERN_ERR"Cannot create workqueue.\n");
+		return -ENOMEM;
+	}
+	// Without it the swaps are not pre-staged.
+	prestage_wq = alloc_workqueue("da_prestage",WQ_UNBOUND,1);
+	if(!prestage_wq) printk(KERN_ERR"Cannot create the pre-staging workqueue.\n");
+
+	// In simulation mode there is no PL, so the ID register is not used.
+	if(!simulate && !sim_id_reg)
+	{
+		retval = id_reg_init();
+		if(retval) goto err0;
+	}
+
+	// Fake FPGA manager for testing without the PL.
+	if(fake_fpga_mgr)
+	{
+		fake_fpga_pdev = platform_device_register_simple("da-fake-fpga",-1,NULL,0);
+		if(IS_ERR(fake_fpga_pdev) || fpga_mgr_register(&fake_fpga_pdev->dev,"Device Attacher fake FPGA manager",&fake_fpga_ops,NULL))
+		{
+			printk(KERN_ERR"Cannot register fake FPGA manager.\n");
+			retval = -ENODEV;
+			goto err2;
+		}
+	}
+
+	// Userspace request interface.
+	retval = misc_register(&da_miscdev);
+	if(retval)
+	{
+		printk(KERN_ERR"Cannot register device_attacher misc device.\n");
+		goto err3;
+	}
+
+	// Statistics
+	da_debugfs = debugfs_create_dir("device_attacher",NULL);
+	debugfs_create_file("sched_stats",0444,da_debugfs,NULL,&sched_stats_fops);
+	debugfs_create_file("swap_stats",0444,da_debugfs,NULL,&swap_stats_fops);
+	debugfs_create_file("mmio_trace",0644,da_debugfs,NULL,&mmio_trace_fops);
+	debugfs_create_file("prestage_stats",0644,da_debugfs,NULL,&prestage_stats_fops);
+	if(!simulate) debugfs_create_file("reconfigure",0200,da_debugfs,NULL,&reconfigure_fops);
+
+	printk(KERN_INFO"Device Attacher loaded successfully.\n");
+
+	// If startup_check module parameter is not 0, perform the ID check.
+	if(startup_check != 0 && !simulate && !sim_id_reg)
+		queue_work(wq,&load_job);
+	return 0;
+
+
+	err3:
+		if(fake_fpga_pdev) fpga_mgr_unregister(&fake_fpga_pdev->dev);
+	err2:
+		if(!IS_ERR_OR_NULL(fake_fpga_pdev)) platform_device_unregister(fake_fpga_pdev);
+		fake_fpga_pdev = NULL;
+		if(!simulate && !sim_id_reg)
+		{
+			free_irq(id_interrupt,NULL);
+			id_reg_exit();
+		}
+	err0:
+		if(prestage_wq) destroy_workqueue(prestage_wq);
+		destroy_workqueue(wq);
+		return retval;
+}
+
+static void __exit  da_exit(void)
+{
+	int i;
+	struct workqueue_struct *pwq;
+
+	debugfs_remove_recursive(da_debugfs);
+	misc_deregister(&da_miscdev);
+	if(!simulate && !sim_id_reg) free_irq(id_interrupt,NULL);
+	// The pre-staging is stopped first. prestage_kick is called with load_lock held, the swaps still pending on wq
+	// cannot restart it without prestage_wq.
+	mutex_lock(&load_lock);
+	pwq = prestage_wq;
+	prestage_wq = NULL;
+	mutex_unlock(&load_lock);
+	cancel_delayed_work_sync(&prestage_job);
+	flush_workqueue(wq);
+	destroy_workqueue(wq);
+	if(pwq) destroy_workqueue(pwq);
+
+	// Delete current device tree overlay
+	mutex_lock(&load_lock);
+	remove_overlay();
+	for(i=0;i<DA_MAX_ID;i++) prestage_drop(i);
+	mutex_unlock(&load_lock);
+	for(i=0;i<DA_MAX_ID;i++) kfree(overlay_cache[i].blob);
+
+	if(fake_fpga_pdev)
+	{
+		fpga_mgr_unregister(&fake_fpga_pdev->dev);
+		platform_device_unregister(fake_fpga_pdev);
+	}
+
+	if(!simulate && !sim_id_reg) id_reg_exit();
 	printk(KERN_INFO"Device Attacher unloaded.\n");
 }
 
@@ -32,6 +32,32 @@
 #include <linux/of_address.h>
 
 #include <linux/string.h>
+#include <linux/spinlock.h>
+#include <linux/atomic.h>
+#include <linux/wait.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/hrtimer.h>
+#include <linux/percpu.h>
+#include <linux/vmalloc.h>
+#include <linux/sort.h>
+#include <linux/seqlock.h>
+#include <linux/pwm.h>
+#include <linux/leds.h>
+#include <linux/poll.h>
+#include <linux/sched.h>
+#include <linux/mutex.h>
+#include <linux/dmaengine.h>
+#include <linux/dma-mapping.h>
+#include <linux/scatterlist.h>
+#include <linux/completion.h>
+#include <linux/miscdevice.h>
+#include <linux/rcupdate.h>
+
+#define CREATE_TRACE_POINTS
+#include "pl_trace.h"
 
 u32 str2int(const char*str,int len);
 int uint2str(u32 num, char*str,size_t len);
@@ -46,7 +72,7 @@ int uint2str(u32 num, char*str,size_t len);
 
 // Own data stucture, containing the data of the character device(s).
 struct chardev_data_type{
-	struct cdev char_dev;
+	struct cdev *char_dev;
 	struct class *myclass;
 	struct device *interface_device[8];
 	int Major;
@@ -54,13 +80,431 @@ struct chardev_data_type{
 	void __iomem *base;
 };
 
+// Peripheral IDs, as reported by the ID register of the PL.
+#define PERIPH_ID_PWM	1
+#define PERIPH_ID_RNG	2
+#define PERIPH_ID_SW	3
+#define PERIPH_ID_TIMER	4
+// IDs above PERIPH_ID_TIMER are free for new peripherals, bound by the generic driver.
+#define PERIPH_ID_NUM	8
+
+/// Number of register values kept in a snapshot.
+#define SNAPSHOT_REGS 8
+
+/// Number of 32 bit registers of a simulated peripheral.
+#define MODEL_REGS 16
+
+// Behavioural model of a PL peripheral, used instead of the registers in simulation mode.
+struct periph_model{
+	u32 regs[MODEL_REGS];
+	u16 lfsr;			// State of the random number generator.
+	bool irq_pending;		// Interrupt flag of the timer.
+	u64 timer_start_ns;		// Time of the last timer (re)load.
+	u32 timer_load;			// Load of the current period, a new load register value is used from the next reload.
+	struct hrtimer timer;		// Expiry of the timer.
+};
+
+// Shared copy of the registers, read without locking by the file operations. See pl_read32_cached.
+struct reg_cache{
+	seqcount_t seq;
+	spinlock_t lock;		// Serializes the updates.
+	u32 regs[SNAPSHOT_REGS];
+	u64 ns[SNAPSHOT_REGS];		// Time of the last refresh, 0 if never read, REG_CACHE_PINNED if written by the driver.
+	struct delayed_work sampler;	// Periodic refresh of the input registers.
+	u8 sample_mask;			// Registers refreshed by the sampler, bit n is the register at offset 4*n.
+	u32 sampled[SNAPSHOT_REGS];	// Values of the last sampling, to detect the changes.
+	bool sampled_valid;
+};
+
 // Own data structure, containing the data of the platform device.
 struct device_data{
 	int irq_num;
 	struct resource res;
 	struct chardev_data_type chardev_data;
 	void __iomem *base;
+	int periph_id;
+	u32 shadow[SNAPSHOT_REGS];	// Last values written to the registers by the driver.
+	struct periph_model model;
+	struct reg_cache cache;
+	struct dma_chan *dma_chan;	// Channel of the bulk transfers, NULL if the CPU accesses the registers.
+	struct mutex dma_lock;		// Serializes the transfers of the channel.
+	struct completion *dma_wait;	// Transfer being waited for, protected by the lock of the slot.
+	const struct file_operations *fops;	// File operations of the driver bound to the device.
+	bool aborted;			// Removed under running file operations, the transfers in progress fail.
+	struct list_head orphan;	// In the orphans list of the slot, until those file operations are finished.
+};
+
+// Register state of a peripheral, saved when its device is removed and written back when the same peripheral is probed again.
+struct periph_snapshot{
+	bool valid;
+	u32 regs[SNAPSHOT_REGS];
+};
+static struct periph_snapshot snapshots[PERIPH_ID_NUM];
+
+// Module parameters
+static unsigned int restore_mask = 0xFF;
+module_param(restore_mask,uint,0644);
+MODULE_PARM_DESC(restore_mask,"Bit mask of the peripheral IDs, whose register state is restored after a swap. Bit n enables peripheral ID n.");
+
+// Module parameters
+static bool simulate = false;
+module_param(simulate,bool,0444);
+MODULE_PARM_DESC(simulate,"Simulation mode: the devices are created by the module, and their registers are behavioural models of the PL peripherals.");
+
+static unsigned int sim_devices = 0x1E;
+module_param(sim_devices,uint,0444);
+MODULE_PARM_DESC(sim_devices,"Bit mask of the peripheral IDs, that are created in simulation mode. Bit n creates peripheral ID n.");
+
+static unsigned int sim_switches = 0;
+module_param(sim_switches,uint,0644);
+MODULE_PARM_DESC(sim_switches,"State of the simulated switches.");
+
+static bool fop_stats = false;
+module_param(fop_stats,bool,0644);
+MODULE_PARM_DESC(fop_stats,"Measure the duration of the read and write calls of the devices probed after setting it.");
+
+static unsigned int drain_timeout_ms = 100;
+module_param(drain_timeout_ms,uint,0644);
+MODULE_PARM_DESC(drain_timeout_ms,"Time allowed for the file operations in progress to finish, when a device is removed. Their transfers are aborted after it.");
+
+static bool mmio_trace = false;	// Parameter, see mmio_trace_set.
+
+static unsigned int cache_max_age_us[PERIPH_ID_NUM];
+module_param_array(cache_max_age_us,uint,NULL,0644);
+MODULE_PARM_DESC(cache_max_age_us,"Maximum age of the cached register values read by the file operations, indexed by peripheral ID. 0 reads the register on every call.");
+
+static unsigned int cache_sample_ms = 0;
+module_param(cache_sample_ms,uint,0644);
+MODULE_PARM_DESC(cache_sample_ms,"Period of the refresh of the cached input registers (switches) by the kernel, for the devices probed after setting it. Their changes are reported by poll. 0 disables it.");
+
+/// Number of events kept for the sessions of a peripheral.
+#define EVENT_RING_LEN 64
+
+// Persistent state of a peripheral type. Open files point to the slot instead of the device, so they survive the removal
+// of the device, and reattach when the same peripheral is probed again.
+struct periph_slot{
+	spinlock_t lock;
+	struct device_data *data;	// Bound device, NULL while the peripheral is not available.
+	bool claimed;			// A driver is probing or bound to a device of the peripheral.
+	int major;			// Major number of the character devices of the bound device.
+	atomic_t active;		// File operations in progress.
+	wait_queue_head_t drain_wq;
+	struct list_head orphans;	// Removed devices, that are freed when no file operation is in progress.
+	struct work_struct reap;	// Frees the orphans.
+	// Timer interrupts and switch changes, for the sessions. Written only by the event source of the peripheral, and
+	// read by the sessions without locking, each with its own cursor.
+	unsigned long event_head;	// Number of events, the last EVENT_RING_LEN - 1 can be delivered.
+	struct periph_event{
+		u64 ns;
+		u32 val;		// New state of the switches, or the timer control register.
+	} event_ring[EVENT_RING_LEN];
+	wait_queue_head_t event_wq;
+	struct list_head sessions;	// Open files of the peripheral, protected by sessions_lock.
+
+	// Statistics
+	u64 probe_start_ns;		// Time of the start of the last probe.
+	u64 node_ready_ns;		// Time from module load until the character devices of the last probe were created.
+	u64 node_latency_ns;		// Time from the start of the last probe until its character devices were created.
+	u64 probe_ns;			// Duration of the last probe.
+	u64 probes;
+	u64 detach_ns;			// Time of the last detach.
+	u64 swaps;			// Number of reattaches.
+	u64 offline_ns_total;		// Time between detach and reattach, summed for all swaps.
+	u64 offline_ns_max;
+	u64 drain_ns_total;		// Time spent waiting for the file operations in progress.
+	u64 drain_ns_max;
+	u64 drain_timeouts;
+	atomic64_t eagain;		// File operations rejected while the peripheral was not available.
+	atomic64_t cache_hits;		// Register reads served from the cache.
+	atomic64_t mmio_reads;		// Register reads of the file operations, that accessed the device.
+
+	// File operation timing
+	const struct file_operations *fops;	// File operations of the driver, called by the timed file operations.
+	struct fop_stat{
+		atomic64_t calls;
+		atomic64_t ns;
+		atomic64_t bytes;
+	} fop_stat[2];
+};
+static struct periph_slot slots[PERIPH_ID_NUM];
+
+// Per open file data, allocated from session_cache.
+struct periph_session{
+	struct periph_slot *slot;
+	struct list_head node;		// In the sessions list of the slot.
+	pid_t pid;			// Process, that opened the file.
+	unsigned long event_cursor;	// Next event of the slot to be delivered.
+	bool subscribed;		// The file is polled: its reads deliver the queued events one by one.
+	char text[12];			// Value formatted at the start of a read, the rest of the read is served from here.
+	int text_len;
+
+	// Statistics
+	u64 reads;
+	u64 writes;
+	u64 events;			// Events delivered.
+	u64 lost;			// Events overwritten in the ring before delivery.
 };
+static struct kmem_cache *session_cache;
+static DEFINE_MUTEX(sessions_lock);
+
+static inline struct periph_slot *file_slot(struct file *pfile)
+{
+	return ((struct periph_session*)pfile->private_data)->slot;
+}
+
+/**
+ * slot_event - Adds an event of the peripheral to the ring, and wakes the pollers of its files.
+ *
+ * Only one context may produce the events of a slot: the interrupt handler of the timer, or the sampler of the switches.
+ */
+static void slot_event(struct periph_slot *slot, u32 val)
+{
+	unsigned long head = slot->event_head;
+	struct periph_event *ev = &slot->event_ring[head % EVENT_RING_LEN];
+
+	ev->ns = ktime_get_ns();
+	ev->val = val;
+	// The event is written before it is published.
+	smp_store_release(&slot->event_head,head + 1);
+	wake_up_interruptible(&slot->event_wq);
+}
+
+/**
+ * session_next_event - Takes the next event of the session from the ring of the slot, without locking.
+ *
+ * Returns false, if there is no event to deliver.
+ */
+static bool session_next_event(struct periph_session *ss, struct periph_event *ev)
+{
+	struct periph_slot *slot = ss->slot;
+	unsigned long head;
+
+	for(;;)
+	{
+		head = smp_load_acquire(&slot->event_head);
+		if(ss->event_cursor == head) return false;
+		// The entry at head - EVENT_RING_LEN is the next one overwritten by the producer, it is counted as lost.
+		if(head - ss->event_cursor >= EVENT_RING_LEN)
+		{
+			ss->lost += head - ss->event_cursor - EVENT_RING_LEN + 1;
+			ss->event_cursor = head - EVENT_RING_LEN + 1;
+		}
+		*ev = slot->event_ring[ss->event_cursor % EVENT_RING_LEN];
+		// Valid, if the producer did not start to overwrite the entry during the copy.
+		smp_rmb();
+		if(READ_ONCE(slot->event_head) - ss->event_cursor < EVENT_RING_LEN) break;
+	}
+	ss->event_cursor++;
+	ss->events++;
+	return true;
+}
+
+/**
+ * session_skip_events - Marks all events of the slot as delivered to the session.
+ */
+static void session_skip_events(struct periph_session *ss)
+{
+	unsigned long head = smp_load_acquire(&ss->slot->event_head);
+
+	ss->events += head - ss->event_cursor;
+	ss->event_cursor = head;
+}
+
+/**
+ * session_read_text - Serves a read from the text of the session.
+ */
+static ssize_t session_read_text(struct periph_session *ss, char __user *buff, size_t count, loff_t *ppos)
+{
+	ss->reads++;
+	if(*ppos >= ss->text_len) return 0;
+	if(*ppos + count > ss->text_len) count = ss->text_len - *ppos;
+	if(copy_to_user(buff,ss->text + *ppos,count)) return -EFAULT;
+	*ppos += count;
+	return count;
+}
+
+static struct file_operations timed_fops;
+
+// Time of the module loading and duration of the driver registration.
+static u64 module_load_ns;
+static u64 module_init_ns;
+
+/**
+ * slot_tryget - Gets the device bound to the slot and marks an operation in progress. Release it with slot_put.
+ *
+ * Returns NULL, if the peripheral is not available. Can be called from interrupt context.
+ */
+static struct device_data *slot_tryget(struct periph_slot *slot)
+{
+	struct device_data *data;
+	unsigned long flags;
+
+	spin_lock_irqsave(&slot->lock,flags);
+	data = slot->data;
+	if(data) atomic_inc(&slot->active);
+	spin_unlock_irqrestore(&slot->lock,flags);
+	return data;
+}
+
+/**
+ * slot_get - Gets the device bound to the slot for a file operation. Release it with slot_put.
+ *
+ * Returns NULL, if the peripheral is not available.
+ */
+static struct device_data *slot_get(struct periph_slot *slot)
+{
+	struct device_data *data = slot_tryget(slot);
+
+	if(!data) atomic64_inc(&slot->eagain);
+	return data;
+}
+
+static void slot_put(struct periph_slot *slot)
+{
+	unsigned long flags;
+
+	if(!atomic_dec_and_test(&slot->active)) return;
+	wake_up(&slot->drain_wq);
+	spin_lock_irqsave(&slot->lock,flags);
+	if(!list_empty(&slot->orphans)) schedule_work(&slot->reap);
+	spin_unlock_irqrestore(&slot->lock,flags);
+}
+
+/**
+ * slot_claim - Reserves the slot for the device being probed. Returns false, if a device of the peripheral is already
+ * probed or bound.
+ */
+static bool slot_claim(struct periph_slot *slot)
+{
+	bool claimed;
+	unsigned long flags;
+
+	spin_lock_irqsave(&slot->lock,flags);
+	claimed = !slot->claimed;
+	slot->claimed = true;
+	spin_unlock_irqrestore(&slot->lock,flags);
+	return claimed;
+}
+
+static void slot_unclaim(struct periph_slot *slot)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&slot->lock,flags);
+	slot->claimed = false;
+	spin_unlock_irqrestore(&slot->lock,flags);
+}
+
+/**
+ * slot_attach - Makes the device available for the open and newly opened files.
+ * @pdev: Platform device, initialized by alloc_resources.
+ */
+static void slot_attach(struct platform_device *pdev)
+{
+	struct device_data *data = platform_get_drvdata(pdev);
+	struct periph_slot *slot = &slots[data->periph_id];
+	u64 offline_ns;
+	unsigned long flags;
+
+	spin_lock_irqsave(&slot->lock,flags);
+	slot->data = data;
+	spin_unlock_irqrestore(&slot->lock,flags);
+	wake_up_interruptible(&slot->event_wq);
+
+	slot->probes++;
+	slot->probe_ns = ktime_get_ns() - slot->probe_start_ns;
+
+	if(slot->detach_ns)
+	{
+		offline_ns = ktime_get_ns() - slot->detach_ns;
+		slot->swaps++;
+		slot->offline_ns_total += offline_ns;
+		if(offline_ns > slot->offline_ns_max) slot->offline_ns_max = offline_ns;
+		printk(KERN_DEBUG"Peripheral %d reattached after %llu us.\n",data->periph_id,div_u64(offline_ns,NSEC_PER_USEC));
+	}
+}
+
+/**
+ * slot_detach - Rejects new file operations on the device and waits for the ones in progress, at most drain_timeout_ms.
+ * @data: Device to be removed.
+ *
+ * On timeout the transfer in progress is aborted, and false is returned: the device must be freed by slot_orphan.
+ */
+static bool slot_detach(struct device_data *data)
+{
+	struct periph_slot *slot = &slots[data->periph_id];
+	u64 start, drain_ns;
+	unsigned long flags;
+	bool drained = true;
+
+	start = ktime_get_ns();
+	spin_lock_irqsave(&slot->lock,flags);
+	if(slot->data != data)
+	{
+		spin_unlock_irqrestore(&slot->lock,flags);
+		return true;
+	}
+	slot->data = NULL;
+	spin_unlock_irqrestore(&slot->lock,flags);
+	wake_up_interruptible(&slot->event_wq);
+
+	if(!wait_event_timeout(slot->drain_wq,atomic_read(&slot->active) == 0,msecs_to_jiffies(drain_timeout_ms)))
+	{
+		printk(KERN_WARNING"File operations of peripheral %d are not finished in %u ms, they are aborted.\n",data->periph_id,drain_timeout_ms);
+		slot->drain_timeouts++;
+		spin_lock_irqsave(&slot->lock,flags);
+		data->aborted = true;
+		if(data->dma_wait) complete(data->dma_wait);
+		spin_unlock_irqrestore(&slot->lock,flags);
+		if(data->dma_chan) dmaengine_terminate_all(data->dma_chan);
+		drained = atomic_read(&slot->active) == 0;
+	}
+
+	slot->detach_ns = ktime_get_ns();
+	drain_ns = slot->detach_ns - start;
+	slot->drain_ns_total += drain_ns;
+	if(drain_ns > slot->drain_ns_max) slot->drain_ns_max = drain_ns;
+	return drained;
+}
+
+static void release_device(struct device_data *data);
+
+/**
+ * slot_orphan - Frees the device, when the file operations still using it are finished.
+ * @data: Device detached by slot_detach.
+ *
+ * The registers stay mapped until then. As the operations of the slot are counted together, the device is freed when
+ * no operation of the slot is in progress.
+ */
+static void slot_orphan(struct device_data *data)
+{
+	struct periph_slot *slot = &slots[data->periph_id];
+	unsigned long flags;
+
+	spin_lock_irqsave(&slot->lock,flags);
+	list_add_tail(&data->orphan,&slot->orphans);
+	spin_unlock_irqrestore(&slot->lock,flags);
+	// The last operation may have finished before the device was added.
+	if(atomic_read(&slot->active) == 0) schedule_work(&slot->reap);
+}
+
+// Frees the orphans of the slot, when no file operation is in progress.
+static void slot_reap_worker(struct work_struct *ws)
+{
+	struct periph_slot *slot = container_of(ws,struct periph_slot,reap);
+	struct device_data *data, *tmp;
+	unsigned long flags;
+	LIST_HEAD(dead);
+
+	spin_lock_irqsave(&slot->lock,flags);
+	if(atomic_read(&slot->active) == 0) list_splice_init(&slot->orphans,&dead);
+	spin_unlock_irqrestore(&slot->lock,flags);
+	list_for_each_entry_safe(data,tmp,&dead,orphan)
+	{
+		list_del(&data->orphan);
+		release_device(data);
+	}
+}
 
 /**
  * create_chardev - creates character devices with the given parameters
@@ -90,18 +534,22 @@ int create_chardev(struct chardev_data_type *chardev_data,const char* name_base,
 		goto err1;
 	}
 	chardev_data->Major = MAJOR(dev_num);
-	printk(KERN_DEBUG"Major number allocation succeeded: %d.\n",chardev_data->Major);
-
-	// Init cdev
-	cdev_init(&chardev_data->char_dev,fops);
-	chardev_data->char_dev.count = 0;
-	chardev_data->char_dev.owner = THIS_MODULE;
-	chardev_data->char_dev.dev = dev_num;
-	retval = cdev_add(&chardev_data->char_dev,dev_num,num);
+	pr_debug("Major number allocation succeeded: %d.\n",chardev_data->Major);
+
+	// Init cdev. It is allocated dynamically, because open files may hold it after the device is removed.
+	chardev_data->char_dev = cdev_alloc();
+	if(!chardev_data->char_dev)
+	{
+		retval = -ENOMEM;
+		goto err2;
+	}
+	chardev_data->char_dev->ops = fops;
+	chardev_data->char_dev->owner = THIS_MODULE;
+	retval = cdev_add(chardev_data->char_dev,dev_num,num);
 	if(retval < 0)
 	{
 		retval = -ENODEV;
-		goto err2;
+		goto err3;
 	}
 
 	// Create class
@@ -132,6 +580,8 @@ int create_chardev(struct chardev_data_type *chardev_data,const char* name_base,
 	printk(KERN_DEBUG"Chardev creation succeeded.\n");
 	return 0;
 
+	err3:
+	kobject_put(&chardev_data->char_dev->kobj);
 	err2:
 	unregister_chrdev_region(dev_num,num);
 	err1:
@@ -155,7 +605,7 @@ int remove_chardev(struct chardev_data_type *chardev_data)
 	class_destroy(chardev_data->myclass);
 
 	//Unregister character device
-	cdev_del(&chardev_data->char_dev);
+	cdev_del(chardev_data->char_dev);
 	unregister_chrdev_region(MKDEV(chardev_data->Major,0),chardev_data->minor_num);
 	return 0;
 }
@@ -163,642 +613,3472 @@ int remove_chardev(struct chardev_data_type *chardev_data)
 /// Length of the remapped address space for the devices.
 #define IOREMAP_SIZE 64
 
+/******************************************************
+ * ****** Register access and peripheral models *******
+ * ****************************************************/
+
+irqreturn_t timer_irq_handler(int irq, void *dev_id);
+
+/// Clock frequency of the PL peripherals.
+#define PL_CLK_HZ 100000000
+
+// AXI timer control register bits
+#define TCSR_UDT	0x002	// Down counting
+#define TCSR_LOAD	0x020	// Load the counter from the load register
+#define TCSR_ENIT	0x040	// Enable interrupt
+#define TCSR_ENT	0x080	// Enable timer
+#define TCSR_TINT	0x100	// Interrupt flag, cleared by writing 1
+
 /**
- * alloc_resources - Allocates the interrupt line and memory region used by the device, and saves the informations about them as driver_data in the platform_device.
- * @pdev: Platform device to be used.
- * @ name_base, num, fops: Parameters for create_chardev.
+ * model_timer_period_ns - Gives the current period of the simulated timer. The timer reloads after load + 2 cycles.
  */
-static int alloc_resources(struct platform_device *pdev,const char* name_base, int num, struct file_operations *fops)
+static u64 model_timer_period_ns(struct periph_model *model)
 {
-	//Locals
-	int retval;
-	struct device_data *data;
+	return div_u64(((u64)model->timer_load + 2) * NSEC_PER_SEC,PL_CLK_HZ);
+}
 
-	printk(KERN_DEBUG"Allocating platform device resources.\n");
+static enum hrtimer_restart model_timer_expired(struct hrtimer *timer)
+{
+	struct periph_model *model = container_of(timer,struct periph_model,timer);
+
+	// Reload
+	model->timer_start_ns = ktime_to_ns(hrtimer_get_expires(timer));
+	model->timer_load = model->regs[1];
+	model->irq_pending = true;
+	if(model->regs[0] & TCSR_ENIT) timer_irq_handler(0,NULL);
+	hrtimer_forward_now(timer,ns_to_ktime(model_timer_period_ns(model)));
+	return HRTIMER_RESTART;
+}
 
-	// Allocating container struct for device data.
-	data = kmalloc(sizeof(struct device_data),GFP_KERNEL);
-	if(!data)
-	{
-		printk(KERN_ERR"Insufficient memory.\n");
-		return -ENOMEM;
-	}
-	memset(data,0,sizeof(struct device_data));
+static void model_init(struct device_data *data)
+{
+	data->model.lfsr = 1;
+	hrtimer_init(&data->model.timer,CLOCK_MONOTONIC,HRTIMER_MODE_REL);
+	data->model.timer.function = model_timer_expired;
+}
 
-	// Getting memory resource
-	retval = of_address_to_resource(pdev->dev.of_node,0,&data->res);
-	if(retval != 0)
-	{
-		printk(KERN_ERR"Cannot get address resource of the dplatform device.\n");
-		retval = -ENODATA;
-		goto err1;
-	}
+static void model_exit(struct device_data *data)
+{
+	hrtimer_cancel(&data->model.timer);
+}
 
-	if(!request_mem_region(data->res.start,resource_size(&data->res),pdev->name))
+static u32 model_read(struct device_data *data, unsigned int offset)
+{
+	struct periph_model *model = &data->model;
+	u64 cycles;
+
+	switch(data->periph_id)
 	{
-		printk(KERN_ERR"Cannot allocate memory region from: %x.\n",data->res.start);
-		retval = -EBUSY;
-		goto err1;
+	case PERIPH_ID_SW:
+		return sim_switches;
+	case PERIPH_ID_RNG:
+		// 16 bit Galois LFSR
+		model->lfsr = (model->lfsr >> 1) ^ (-(model->lfsr & 1u) & 0xB400u);
+		return model->lfsr;
+	case PERIPH_ID_TIMER:
+		if(offset == 0) return model->regs[0] | (model->irq_pending ? TCSR_TINT : 0);
+		if(offset == 8)
+		{
+			// Counter register
+			if(!(model->regs[0] & TCSR_ENT)) return model->regs[2];
+			cycles = div_u64((ktime_get_ns() - model->timer_start_ns) * (PL_CLK_HZ/1000000),1000);
+			return model->timer_load - (u32)do_div(cycles,(u64)model->timer_load + 2);
+		}
+		break;
+	default:
+		break;
 	}
+	return model->regs[(offset/4) % MODEL_REGS];
+}
 
-	printk(KERN_DEBUG"Physical address start: 0x%x.\n",data->res.start);
+static void model_write(struct device_data *data, unsigned int offset, u32 val)
+{
+	struct periph_model *model = &data->model;
 
-	//Remapping hw address to kernel space.
-	data->base = ioremap(data->res.start,IOREMAP_SIZE);
-	data->chardev_data.base = data->base;
-	if(!data->base)
+	switch(data->periph_id)
 	{
-		retval = -EIO;
-		goto err2;
+	case PERIPH_ID_RNG:
+		model->lfsr = val ? val : 1;
+		return;
+	case PERIPH_ID_TIMER:
+		if(offset != 0) break;
+		if(val & TCSR_TINT) model->irq_pending = false;
+		if(val & TCSR_LOAD) model->regs[2] = model->regs[1];
+		if((val & TCSR_ENT) && !(model->regs[0] & TCSR_ENT))
+		{
+			model->timer_start_ns = ktime_get_ns();
+			model->timer_load = model->regs[1];
+			hrtimer_start(&model->timer,ns_to_ktime(model_timer_period_ns(model)),HRTIMER_MODE_REL);
+		}
+		else if(!(val & TCSR_ENT) && (model->regs[0] & TCSR_ENT))
+			hrtimer_try_to_cancel(&model->timer);
+		model->regs[0] = val & ~(TCSR_TINT | TCSR_LOAD);
+		return;
+	default:
+		break;
 	}
+	model->regs[(offset/4) % MODEL_REGS] = val;
+}
 
-	printk(KERN_DEBUG"Remapped base address: 0x%x.\n",(unsigned int)data->base);
-
-	// Remap device interrupt, if exists
-	data->irq_num = irq_of_parse_and_map(pdev->dev.of_node,0);
-	if(data->irq_num > 0) printk(KERN_DEBUG"Used interrupt line: %d.\n",data->irq_num);
+/// Number of records in the trace ring of a CPU.
+#define MMIO_TRACE_LEN 4096
+
+// Register access types of the trace
+#define MMIO_READ32	0
+#define MMIO_READ16	1
+#define MMIO_WRITE32	2
+
+// One register access of the trace, as read from the mmio_trace debugfs file.
+// device_attacher writes the same 24 byte records, with peripheral ID 0 for the ID register.
+struct mmio_trace_rec{
+	u64 ns;			// Start of the access.
+	u32 val;		// Value read or written.
+	u32 dur_ns;		// Duration of the access.
+	u16 offset;		// Byte offset of the register.
+	u8 periph_id;
+	u8 op;
+	u32 cpu;
+};
 
-	// Save data to platform_device
-	platform_set_drvdata(pdev,data);
+struct mmio_trace_ring{
+	unsigned int head;	// Number of records written since the last clear, the ring keeps the last MMIO_TRACE_LEN.
+	struct mmio_trace_rec rec[MMIO_TRACE_LEN];
+};
+static DEFINE_PER_CPU(struct mmio_trace_ring *,mmio_rings);	// Allocated only while recording.
 
-	//Create character device
-	retval = create_chardev(&(data->chardev_data),name_base,num,fops);
-	if(retval)
+/**
+ * mmio_trace_add - Appends a register access to the trace ring of the current CPU.
+ * @start_ns: Time before the access.
+ */
+static void mmio_trace_add(int periph_id, int op, unsigned int offset, u32 val, u64 start_ns)
+{
+	unsigned long flags;
+	struct mmio_trace_ring *ring;
+	struct mmio_trace_rec *rec;
+	u64 now = ktime_get_ns();
+
+	// The timer registers are also accessed from its interrupt handler.
+	local_irq_save(flags);
+	ring = __this_cpu_read(mmio_rings);
+	if(ring)
 	{
-		printk(KERN_ERR"Character device creation failed.\n");
-		goto err3;
+		rec = &ring->rec[ring->head++ % MMIO_TRACE_LEN];
+		rec->ns = start_ns;
+		rec->val = val;
+		rec->dur_ns = min_t(u64,now - start_ns,U32_MAX);
+		rec->offset = offset;
+		rec->periph_id = periph_id;
+		rec->op = op;
+		rec->cpu = smp_processor_id();
 	}
-
-
-	return 0;
-	err3:
-		iounmap(data->base);
-	err2:
-		release_mem_region(data->res.start,resource_size(&data->res));
-	err1:
-		kfree(data);
-		platform_set_drvdata(pdev,NULL);
-	return retval;
+	local_irq_restore(flags);
 }
 
 /**
- * free_resources - Deallocates the resources stored in the driver_data field of the platform device.
- * @pdev: Pointer to the actual platform_device.
+ * pl_read32 - Reads a register of the device, or its model in simulation mode.
+ * @offset: Byte offset of the register.
  */
-static int free_resources(struct platform_device *pdev)
+static inline u32 pl_read32(struct device_data *data, unsigned int offset)
 {
-	// Locals
-	struct device_data *data;
-
-	data = platform_get_drvdata(pdev);
-	if(!data) goto err;
-	remove_chardev(&(data->chardev_data));
-	iounmap(data->base);
-	data->base = NULL;
-	data->chardev_data.base = NULL;
-	release_mem_region(data->res.start,resource_size(&data->res));
-	kfree(data);
-	platform_set_drvdata(pdev,NULL);
-	printk(KERN_DEBUG"Device resources are deallocated.\n");
+	u64 start = mmio_trace ? ktime_get_ns() : 0;
+	u32 val = simulate ? model_read(data,offset) : ioread32(data->base + offset);
 
-err:
-	return -ENODATA;
+	if(start) mmio_trace_add(data->periph_id,MMIO_READ32,offset,val,start);
+	return val;
 }
 
-
-static int general_open(struct inode * inode, struct file *pfile)
+static inline u16 pl_read16(struct device_data *data, unsigned int offset)
 {
-	try_module_get(THIS_MODULE);
-	struct chardev_data_type *data;
+	u64 start = mmio_trace ? ktime_get_ns() : 0;
+	u16 val = simulate ? model_read(data,offset) : ioread16(data->base + offset);
+
+	if(start) mmio_trace_add(data->periph_id,MMIO_READ16,offset,val,start);
+	return val;
+}
 
-	if(!inode->i_cdev) return -ENODEV;
-	// Store a pointer to the chardev_data in the file structure, so that the read/write functions can use the base address in it.
-	data = container_of(inode->i_cdev,struct chardev_data_type,char_dev);
-	if(!data) return -ENODEV;
-	pfile->private_data = data;
+static inline void pl_write32(struct device_data *data, unsigned int offset, u32 val)
+{
+	u64 start = mmio_trace ? ktime_get_ns() : 0;
 
-	return 0;
+	if(simulate) model_write(data,offset,val);
+	else iowrite32(val,data->base + offset);
+	if(start) mmio_trace_add(data->periph_id,MMIO_WRITE32,offset,val,start);
 }
 
+/// Age of the cache entries written by the driver. They do not expire, only the driver changes these registers.
+#define REG_CACHE_PINNED U64_MAX
 
-static int general_close(struct inode * inode, struct file *pfile)
+// Input registers refreshed by the sampler, by peripheral ID. The PL does not signal the change of the switches.
+static const u8 sampled_regs[PERIPH_ID_NUM] = {
+	[PERIPH_ID_SW] = 0x01,
+};
+
+/**
+ * reg_cache_update - Stores a register value in the cache.
+ * @pinned: The value was written by the driver, and stays valid until the next write.
+ */
+static void reg_cache_update(struct device_data *data, unsigned int offset, u32 val, bool pinned)
 {
-	module_put(THIS_MODULE);
-	return 0;
+	struct reg_cache *cache = &data->cache;
+	unsigned int idx = offset/4;
+	unsigned long flags;
+
+	if(idx >= SNAPSHOT_REGS) return;
+	spin_lock_irqsave(&cache->lock,flags);
+	write_seqcount_begin(&cache->seq);
+	cache->regs[idx] = val;
+	cache->ns[idx] = pinned ? REG_CACHE_PINNED : ktime_get_ns();
+	write_seqcount_end(&cache->seq);
+	spin_unlock_irqrestore(&cache->lock,flags);
 }
-/******************************************************************************
- * 							SWITCH DRIVER
- ******************************************************************************/
 
-	///////////////////////// SWITCH FILE OPERATIONS ////////////////////////////////
+static bool reg_cache_fresh(u64 ns, u64 max_age_ns)
+{
+	return ns == REG_CACHE_PINNED || (ns && ktime_get_ns() - ns <= max_age_ns);
+}
 
+/**
+ * pl_read32_cached - Reads a register through the cache of the device, if cache_max_age_us is set for the peripheral.
+ * @offset: Byte offset of the register.
+ *
+ * The readers do not take locks while the cached value is fresh. An expired value is refreshed by one reader, the
+ * others waiting for it use the refreshed value, so the device is read at most once per max age.
+ */
+static u32 pl_read32_cached(struct device_data *data, unsigned int offset)
+{
+	struct reg_cache *cache = &data->cache;
+	struct periph_slot *slot = &slots[data->periph_id];
+	unsigned int idx = offset/4;
+	unsigned int seq;
+	unsigned long flags;
+	u64 ns, max_age_ns;
+	u32 val;
 
-	/**
-	 * sw_read - Returns the state of the switches as a string containing 1-s and 0-s.
-	 */
-	static ssize_t sw_read (struct file *pfile, char __user *buff, size_t count, loff_t *ppos)
+	max_age_ns = (u64)READ_ONCE(cache_max_age_us[data->periph_id]) * NSEC_PER_USEC;
+	if(!max_age_ns || idx >= SNAPSHOT_REGS) goto uncached;
+
+	do
 	{
-		u32 val;
-		char bin[9];
-		int i;
+		seq = read_seqcount_begin(&cache->seq);
+		val = cache->regs[idx];
+		ns = cache->ns[idx];
+	} while(read_seqcount_retry(&cache->seq,seq));
+	if(reg_cache_fresh(ns,max_age_ns)) goto hit;
+
+	spin_lock_irqsave(&cache->lock,flags);
+	// Refreshed by an other reader while waiting for the lock.
+	if(reg_cache_fresh(cache->ns[idx],max_age_ns))
+	{
+		val = cache->regs[idx];
+		spin_unlock_irqrestore(&cache->lock,flags);
+		goto hit;
+	}
+	val = pl_read32(data,offset);
+	write_seqcount_begin(&cache->seq);
+	cache->regs[idx] = val;
+	cache->ns[idx] = ktime_get_ns();
+	write_seqcount_end(&cache->seq);
+	spin_unlock_irqrestore(&cache->lock,flags);
+	atomic64_inc(&slot->mmio_reads);
+	return val;
 
-		// Get the base address from the file structure.
-		void __iomem *ks_sw_base = ((struct chardev_data_type*)pfile->private_data)->base;
-		if(!ks_sw_base) return -ENODEV;
+hit:
+	atomic64_inc(&slot->cache_hits);
+	return val;
 
-		val = ioread32(ks_sw_base);
-		// Convert the LSB to binary
-		for(i=0;i<8;i++)
-		{
-			bin[7-i] = '0'+val%2;
-			val /= 2;
-		}
-		bin[8] = 0;
+uncached:
+	atomic64_inc(&slot->mmio_reads);
+	return pl_read32(data,offset);
+}
 
-		if(*ppos > 8) return 0;
-		if(*ppos + count > 9) count = 9 - *ppos;
-		if(copy_to_user(buff,bin + *ppos,count)) return -EFAULT;
-		*ppos += count;
-		return count;
-	}
+static void reg_cache_sample(struct work_struct *ws)
+{
+	struct reg_cache *cache = container_of(to_delayed_work(ws),struct reg_cache,sampler);
+	struct device_data *data = container_of(cache,struct device_data,cache);
+	unsigned int i;
+	u32 val;
 
-	static ssize_t sw_write (struct file *pfile, const char __user *buff, size_t count, loff_t *ppos)
+	for(i=0;i<SNAPSHOT_REGS;i++)
 	{
-
-		printk(KERN_ERR"Switch device is not writable.\n");
-		return 0;
+		if(!(cache->sample_mask & (1 << i))) continue;
+		val = pl_read32(data,i*4);
+		atomic64_inc(&slots[data->periph_id].mmio_reads);
+		reg_cache_update(data,i*4,val,false);
+		// The changes of the switches are events for the sessions.
+		if(cache->sampled_valid && val != cache->sampled[i])
+		{
+			trace_pl_input_change(data->periph_id,i*4,cache->sampled[i],val);
+			slot_event(&slots[data->periph_id],val);
+		}
+		cache->sampled[i] = val;
 	}
+	cache->sampled_valid = true;
+	if(cache_sample_ms) schedule_delayed_work(&cache->sampler,msecs_to_jiffies(cache_sample_ms));
+}
 
-	static struct file_operations sw_fops =
+static void reg_cache_init(struct device_data *data)
+{
+	seqcount_init(&data->cache.seq);
+	spin_lock_init(&data->cache.lock);
+	INIT_DELAYED_WORK(&data->cache.sampler,reg_cache_sample);
+	data->cache.sample_mask = sampled_regs[data->periph_id];
+}
+
+/******************************************************
+ * ************* Bulk transfers by DMA ****************
+ * ****************************************************/
+
+static bool use_dma = true;
+module_param(use_dma,bool,0644);
+MODULE_PARM_DESC(use_dma,"Transfer the long random number reads and the PWM sequences by DMA, if the overlay describes a DMA channel for the device. Otherwise the CPU accesses the registers.");
+
+static bool fake_dma = false;
+module_param(fake_dma,bool,0444);
+MODULE_PARM_DESC(fake_dma,"Simulation mode: register a software DMA engine, that transfers the data of the random number generator and PWM models.");
+
+/// Time allowed for a DMA transfer.
+#define PL_DMA_TIMEOUT_MS 100
+
+static void pl_dma_done(void *param)
+{
+	complete(param);
+}
+
+/**
+ * pl_dma_run - Submits the descriptor on the channel of the device and waits for its completion. The callback of the
+ * descriptor is overwritten. Must be called with dma_lock held.
+ *
+ * The wait ends early with -EIO, if the device is removed meanwhile.
+ */
+static int pl_dma_run(struct device_data *data, struct dma_async_tx_descriptor *desc)
+{
+	DECLARE_COMPLETION_ONSTACK(done);
+	struct dma_chan *chan = data->dma_chan;
+	struct periph_slot *slot = &slots[data->periph_id];
+	unsigned long flags;
+	int ret = 0;
+
+	desc->callback = pl_dma_done;
+	desc->callback_param = &done;
+	if(dma_submit_error(dmaengine_submit(desc))) return -EIO;
+	spin_lock_irqsave(&slot->lock,flags);
+	data->dma_wait = &done;
+	if(data->aborted) complete(&done);
+	spin_unlock_irqrestore(&slot->lock,flags);
+	dma_async_issue_pending(chan);
+	if(!wait_for_completion_timeout(&done,msecs_to_jiffies(PL_DMA_TIMEOUT_MS)))
+	{
+		printk(KERN_ERR"DMA transfer of %s timed out.\n",dma_chan_name(chan));
+		dmaengine_terminate_all(chan);
+		ret = -EIO;
+	}
+	spin_lock_irqsave(&slot->lock,flags);
+	data->dma_wait = NULL;
+	if(data->aborted) ret = -EIO;
+	spin_unlock_irqrestore(&slot->lock,flags);
+	return ret;
+}
+
+// Software DMA engine of the simulation mode. Its channels copy between the memory and the peripheral models on the
+// CPU, synchronously at issue_pending. The addresses of the peripheral side are register offsets, as the simulated
+// devices have no physical address.
+struct fake_dma_chan{
+	struct dma_chan chan;
+	int periph_id;			// Peripheral, whose model is accessed.
+	struct dma_slave_config cfg;
+	spinlock_t lock;
+	struct list_head queued;	// Submitted descriptors.
+};
+
+struct fake_dma_desc{
+	struct dma_async_tx_descriptor tx;
+	struct list_head node;
+	enum dma_transfer_direction dir;
+	struct scatterlist *sgl;	// DMA_DEV_TO_MEM
+	unsigned int sg_len;
+	dma_addr_t dst, src;		// DMA_MEM_TO_DEV
+	size_t len;
+};
+
+static struct platform_device *fake_dma_pdev;
+static struct dma_device fake_dma_dev;
+static struct fake_dma_chan fake_dma_chans[2];
+
+static inline struct fake_dma_chan *to_fake_chan(struct dma_chan *chan)
+{
+	return container_of(chan,struct fake_dma_chan,chan);
+}
+
+static int fake_dma_alloc_chan_resources(struct dma_chan *chan)
+{
+	return 0;
+}
+
+static void fake_dma_free_chan_resources(struct dma_chan *chan)
+{
+}
+
+static int fake_dma_config(struct dma_chan *chan, struct dma_slave_config *cfg)
+{
+	to_fake_chan(chan)->cfg = *cfg;
+	return 0;
+}
+
+static dma_cookie_t fake_dma_submit(struct dma_async_tx_descriptor *tx)
+{
+	struct fake_dma_chan *fc = to_fake_chan(tx->chan);
+	struct fake_dma_desc *desc = container_of(tx,struct fake_dma_desc,tx);
+	unsigned long flags;
+
+	spin_lock_irqsave(&fc->lock,flags);
+	if(++fc->chan.cookie < DMA_MIN_COOKIE) fc->chan.cookie = DMA_MIN_COOKIE;
+	tx->cookie = fc->chan.cookie;
+	list_add_tail(&desc->node,&fc->queued);
+	spin_unlock_irqrestore(&fc->lock,flags);
+	return tx->cookie;
+}
+
+static struct fake_dma_desc *fake_dma_desc_alloc(struct dma_chan *chan, enum dma_transfer_direction dir, unsigned long flags)
+{
+	struct fake_dma_desc *desc = kzalloc(sizeof(*desc),GFP_NOWAIT);
+
+	if(!desc) return NULL;
+	dma_async_tx_descriptor_init(&desc->tx,chan);
+	desc->tx.tx_submit = fake_dma_submit;
+	desc->tx.flags = flags;
+	desc->dir = dir;
+	return desc;
+}
+
+static struct dma_async_tx_descriptor *fake_dma_prep_slave_sg(struct dma_chan *chan, struct scatterlist *sgl,
+		unsigned int sg_len, enum dma_transfer_direction dir, unsigned long flags, void *context)
+{
+	struct fake_dma_desc *desc;
+
+	if(dir != DMA_DEV_TO_MEM) return NULL;
+	desc = fake_dma_desc_alloc(chan,dir,flags);
+	if(!desc) return NULL;
+	desc->sgl = sgl;
+	desc->sg_len = sg_len;
+	return &desc->tx;
+}
+
+static struct dma_async_tx_descriptor *fake_dma_prep_memcpy(struct dma_chan *chan, dma_addr_t dst, dma_addr_t src,
+		size_t len, unsigned long flags)
+{
+	struct fake_dma_desc *desc = fake_dma_desc_alloc(chan,DMA_MEM_TO_DEV,flags);
+
+	if(!desc) return NULL;
+	desc->dst = dst;
+	desc->src = src;
+	desc->len = len;
+	return &desc->tx;
+}
+
+/**
+ * fake_dma_exec - Executes a descriptor on the model of the peripheral of the channel.
+ *
+ * The buffers are mapped by the coherent DMA operations of the engine, so the CPU reaches them at their linear address.
+ */
+static void fake_dma_exec(struct fake_dma_chan *fc, struct fake_dma_desc *desc)
+{
+	struct device_data *data = READ_ONCE(slots[fc->periph_id].data);
+	struct scatterlist *sg;
+	unsigned int i, j;
+	u16 *p16;
+	u32 *p32;
+
+	if(!data) return;
+	if(desc->dir == DMA_DEV_TO_MEM)
+	{
+		for_each_sg(desc->sgl,sg,desc->sg_len,i)
+		{
+			p16 = sg_virt(sg);
+			p32 = sg_virt(sg);
+			if(fc->cfg.src_addr_width == DMA_SLAVE_BUSWIDTH_2_BYTES)
+				for(j=0;j<sg_dma_len(sg)/2;j++) p16[j] = pl_read16(data,fc->cfg.src_addr);
+			else
+				for(j=0;j<sg_dma_len(sg)/4;j++) p32[j] = pl_read32(data,fc->cfg.src_addr);
+		}
+	}
+	else
+	{
+		p32 = phys_to_virt(desc->src);
+		for(j=0;j<desc->len/4;j++) pl_write32(data,desc->dst + j*4,p32[j]);
+	}
+}
+
+static void fake_dma_issue_pending(struct dma_chan *chan)
+{
+	struct fake_dma_chan *fc = to_fake_chan(chan);
+	struct fake_dma_desc *desc;
+	unsigned long flags;
+
+	for(;;)
+	{
+		spin_lock_irqsave(&fc->lock,flags);
+		desc = list_first_entry_or_null(&fc->queued,struct fake_dma_desc,node);
+		if(desc) list_del(&desc->node);
+		spin_unlock_irqrestore(&fc->lock,flags);
+		if(!desc) break;
+
+		fake_dma_exec(fc,desc);
+		chan->completed_cookie = desc->tx.cookie;
+		if(desc->tx.callback) desc->tx.callback(desc->tx.callback_param);
+		kfree(desc);
+	}
+}
+
+static enum dma_status fake_dma_tx_status(struct dma_chan *chan, dma_cookie_t cookie, struct dma_tx_state *state)
+{
+	dma_set_tx_state(state,chan->completed_cookie,chan->cookie,0);
+	return cookie <= chan->completed_cookie ? DMA_COMPLETE : DMA_IN_PROGRESS;
+}
+
+static int fake_dma_terminate_all(struct dma_chan *chan)
+{
+	struct fake_dma_chan *fc = to_fake_chan(chan);
+	struct fake_dma_desc *desc, *tmp;
+	unsigned long flags;
+
+	spin_lock_irqsave(&fc->lock,flags);
+	list_for_each_entry_safe(desc,tmp,&fc->queued,node)
+	{
+		list_del(&desc->node);
+		kfree(desc);
+	}
+	spin_unlock_irqrestore(&fc->lock,flags);
+	return 0;
+}
+
+/**
+ * fake_dma_register - Registers the software DMA engine, with one channel for the RNG and one for the PWM model.
+ */
+static int fake_dma_register(void)
+{
+	int i;
+	int retval;
+	static const int periph_ids[2] = {PERIPH_ID_RNG,PERIPH_ID_PWM};
+
+	fake_dma_pdev = platform_device_register_simple("dd-fake-dma",-1,NULL,0);
+	if(IS_ERR(fake_dma_pdev))
+	{
+		retval = PTR_ERR(fake_dma_pdev);
+		fake_dma_pdev = NULL;
+		return retval;
+	}
+	dma_coerce_mask_and_coherent(&fake_dma_pdev->dev,DMA_BIT_MASK(32));
+#ifdef CONFIG_ARM
+	// The CPU does the copies, the buffers need no cache maintenance.
+	set_dma_ops(&fake_dma_pdev->dev,&arm_coherent_dma_ops);
+#endif
+
+	memset(&fake_dma_dev,0,sizeof(fake_dma_dev));
+	fake_dma_dev.dev = &fake_dma_pdev->dev;
+	INIT_LIST_HEAD(&fake_dma_dev.channels);
+	dma_cap_set(DMA_SLAVE,fake_dma_dev.cap_mask);
+	dma_cap_set(DMA_MEMCPY,fake_dma_dev.cap_mask);
+	dma_cap_set(DMA_PRIVATE,fake_dma_dev.cap_mask);
+	fake_dma_dev.directions = BIT(DMA_DEV_TO_MEM) | BIT(DMA_MEM_TO_DEV);
+	fake_dma_dev.device_alloc_chan_resources = fake_dma_alloc_chan_resources;
+	fake_dma_dev.device_free_chan_resources = fake_dma_free_chan_resources;
+	fake_dma_dev.device_prep_slave_sg = fake_dma_prep_slave_sg;
+	fake_dma_dev.device_prep_dma_memcpy = fake_dma_prep_memcpy;
+	fake_dma_dev.device_config = fake_dma_config;
+	fake_dma_dev.device_terminate_all = fake_dma_terminate_all;
+	fake_dma_dev.device_issue_pending = fake_dma_issue_pending;
+	fake_dma_dev.device_tx_status = fake_dma_tx_status;
+	for(i=0;i<2;i++)
+	{
+		fake_dma_chans[i].periph_id = periph_ids[i];
+		spin_lock_init(&fake_dma_chans[i].lock);
+		INIT_LIST_HEAD(&fake_dma_chans[i].queued);
+		fake_dma_chans[i].chan.device = &fake_dma_dev;
+		list_add_tail(&fake_dma_chans[i].chan.device_node,&fake_dma_dev.channels);
+	}
+
+	retval = dma_async_device_register(&fake_dma_dev);
+	if(retval)
+	{
+		platform_device_unregister(fake_dma_pdev);
+		fake_dma_pdev = NULL;
+	}
+	return retval;
+}
+
+static void fake_dma_unregister(void)
+{
+	if(!fake_dma_pdev) return;
+	dma_async_device_unregister(&fake_dma_dev);
+	platform_device_unregister(fake_dma_pdev);
+	fake_dma_pdev = NULL;
+}
+
+static bool fake_dma_filter(struct dma_chan *chan, void *param)
+{
+	return chan->device == &fake_dma_dev && to_fake_chan(chan)->periph_id == (long)param;
+}
+
+/**
+ * pl_dma_request - Gets the DMA channel of the device, named by dma-names in the overlay.
+ * @cap: Required capability: DMA_SLAVE or DMA_MEMCPY.
+ * @cfg: Slave configuration, or NULL.
+ *
+ * Returns NULL, if the device has no usable channel. The drivers access the registers by the CPU then.
+ */
+static struct dma_chan *pl_dma_request(struct platform_device *pdev, const char *name, enum dma_transaction_type cap,
+		struct dma_slave_config *cfg)
+{
+	struct device_data *data = platform_get_drvdata(pdev);
+	struct dma_chan *chan;
+	dma_cap_mask_t mask;
+
+	if(simulate)
+	{
+		if(!fake_dma_pdev) return NULL;
+		dma_cap_zero(mask);
+		dma_cap_set(cap,mask);
+		chan = dma_request_channel(mask,fake_dma_filter,(void*)(long)data->periph_id);
+	}
+	else
+		chan = dma_request_slave_channel(&pdev->dev,name);
+	if(!chan) return NULL;
+
+	if(!dma_has_cap(cap,chan->device->cap_mask) || (cfg && dmaengine_slave_config(chan,cfg)))
+	{
+		printk(KERN_ERR"DMA channel %s cannot be used, the registers are accessed by the CPU.\n",dma_chan_name(chan));
+		dma_release_channel(chan);
+		return NULL;
+	}
+	dev_dbg(&pdev->dev,"Peripheral %d uses DMA channel %s.\n",data->periph_id,dma_chan_name(chan));
+	return chan;
+}
+
+/**
+ * alloc_resources - Allocates the interrupt line and memory region used by the device, and saves the informations about them as driver_data in the platform_device.
+ * @pdev: Platform device to be used.
+ * @periph_id: Peripheral ID, the key of the register snapshot.
+ * @ name_base, num, fops: Parameters for create_chardev.
+ */
+static int alloc_resources(struct platform_device *pdev,int periph_id,const char* name_base, int num, struct file_operations *fops)
+{
+	//Locals
+	int retval;
+	struct device_data *data;
+
+	// The probes are asynchronous, two drivers may match devices of the same peripheral at the same time.
+	if(!slot_claim(&slots[periph_id]))
+	{
+		printk(KERN_ERR"Peripheral %d is already bound to a driver.\n",periph_id);
+		return -EBUSY;
+	}
+	slots[periph_id].probe_start_ns = ktime_get_ns();
+
+	// Allocating container struct for device data.
+	data = kmalloc(sizeof(struct device_data),GFP_KERNEL);
+	if(!data)
+	{
+		printk(KERN_ERR"Insufficient memory.\n");
+		slot_unclaim(&slots[periph_id]);
+		return -ENOMEM;
+	}
+	memset(data,0,sizeof(struct device_data));
+	data->periph_id = periph_id;
+	reg_cache_init(data);
+	mutex_init(&data->dma_lock);
+
+	// Simulated devices have no registers and no interrupt line.
+	if(simulate)
+	{
+		model_init(data);
+		platform_set_drvdata(pdev,data);
+		goto chardev;
+	}
+
+	// Getting memory resource
+	retval = of_address_to_resource(pdev->dev.of_node,0,&data->res);
+	if(retval != 0)
+	{
+		printk(KERN_ERR"Cannot get address resource of the dplatform device.\n");
+		retval = -ENODATA;
+		goto err1;
+	}
+
+	if(!request_mem_region(data->res.start,resource_size(&data->res),pdev->name))
+	{
+		printk(KERN_ERR"Cannot allocate memory region from: %x.\n",data->res.start);
+		retval = -EBUSY;
+		goto err1;
+	}
+
+	dev_dbg(&pdev->dev,"Physical address start: 0x%x.\n",data->res.start);
+
+	//Remapping hw address to kernel space.
+	data->base = ioremap(data->res.start,IOREMAP_SIZE);
+	data->chardev_data.base = data->base;
+	if(!data->base)
+	{
+		retval = -EIO;
+		goto err2;
+	}
+
+	dev_dbg(&pdev->dev,"Remapped base address: 0x%x.\n",(unsigned int)data->base);
+
+	// Remap device interrupt, if exists
+	data->irq_num = irq_of_parse_and_map(pdev->dev.of_node,0);
+	if(data->irq_num > 0) dev_dbg(&pdev->dev,"Used interrupt line: %d.\n",data->irq_num);
+
+	// Save data to platform_device
+	platform_set_drvdata(pdev,data);
+
+chardev:
+	//Create character device
+	slots[periph_id].fops = fops;
+	data->fops = fops;
+	retval = create_chardev(&(data->chardev_data),name_base,num,fop_stats ? &timed_fops : fops);
+	if(retval)
+	{
+		printk(KERN_ERR"Character device creation failed.\n");
+		if(simulate) goto err1;
+		goto err3;
+	}
+	slots[periph_id].major = data->chardev_data.Major;
+	slots[periph_id].node_ready_ns = ktime_get_ns();
+	slots[periph_id].node_latency_ns = slots[periph_id].node_ready_ns - slots[periph_id].probe_start_ns;
+	slots[periph_id].node_ready_ns -= module_load_ns;
+
+	if(cache_sample_ms && data->cache.sample_mask) schedule_delayed_work(&data->cache.sampler,0);
+
+	return 0;
+	err3:
+		iounmap(data->base);
+	err2:
+		release_mem_region(data->res.start,resource_size(&data->res));
+	err1:
+		kfree(data);
+		platform_set_drvdata(pdev,NULL);
+		slot_unclaim(&slots[periph_id]);
+	return retval;
+}
+
+/**
+ * free_resources - Deallocates the resources stored in the driver_data field of the platform device.
+ * @pdev: Pointer to the actual platform_device.
+ */
+static int free_resources(struct platform_device *pdev)
+{
+	// Locals
+	struct device_data *data;
+	bool drained;
+	int periph_id;
+
+	data = platform_get_drvdata(pdev);
+	if(!data) goto err;
+	drained = slot_detach(data);
+	cancel_delayed_work_sync(&data->cache.sampler);
+	remove_chardev(&(data->chardev_data));
+	slots[data->periph_id].major = 0;
+
+	// Save the register state for the next probe of the same peripheral.
+	memcpy(snapshots[data->periph_id].regs,data->shadow,sizeof(data->shadow));
+	snapshots[data->periph_id].valid = true;
+
+	// The next device may claim the region, while the aborted operations still use the mapping.
+	if(!simulate) release_mem_region(data->res.start,resource_size(&data->res));
+	platform_set_drvdata(pdev,NULL);
+	periph_id = data->periph_id;
+	if(drained) release_device(data);
+	else slot_orphan(data);
+	slot_unclaim(&slots[periph_id]);
+	printk(KERN_DEBUG"Device resources are deallocated.\n");
+
+err:
+	return -ENODATA;
+}
+
+/**
+ * release_device - Frees the device, when no file operation uses it.
+ */
+static void release_device(struct device_data *data)
+{
+	if(data->dma_chan) dma_release_channel(data->dma_chan);
+	if(simulate) model_exit(data);
+	else iounmap(data->base);
+	kfree(data);
+}
+
+/**
+ * restore_snapshot - Gives the saved register state of the peripheral, if it should be restored.
+ * @pdev: Pointer to the actual platform_device.
+ *
+ * The returned values are copied into the shadow registers, the driver has to write them to the device.
+ */
+static const u32 *restore_snapshot(struct platform_device *pdev)
+{
+	struct device_data *data = platform_get_drvdata(pdev);
+	struct periph_snapshot *snap = &snapshots[data->periph_id];
+
+	if(!snap->valid || !(restore_mask & (1 << data->periph_id))) return NULL;
+	memcpy(data->shadow,snap->regs,sizeof(data->shadow));
+	printk(KERN_DEBUG"Restoring register state of peripheral %d.\n",data->periph_id);
+	return data->shadow;
+}
+
+/**
+ * timed_read - Calls the read function of the driver, and measures its duration.
+ */
+static ssize_t timed_read(struct file *pfile, char __user *buff, size_t count, loff_t *ppos)
+{
+	struct periph_slot *slot = file_slot(pfile);
+	struct fop_stat *stat = &slot->fop_stat[0];
+	u64 start;
+	ssize_t ret;
+
+	start = ktime_get_ns();
+	ret = slot->fops->read(pfile,buff,count,ppos);
+	atomic64_add(ktime_get_ns() - start,&stat->ns);
+	atomic64_inc(&stat->calls);
+	if(ret > 0) atomic64_add(ret,&stat->bytes);
+	return ret;
+}
+
+/**
+ * timed_write - Calls the write function of the driver, and measures its duration.
+ */
+static ssize_t timed_write(struct file *pfile, const char __user *buff, size_t count, loff_t *ppos)
+{
+	struct periph_slot *slot = file_slot(pfile);
+	struct fop_stat *stat = &slot->fop_stat[1];
+	u64 start;
+	ssize_t ret;
+
+	start = ktime_get_ns();
+	ret = slot->fops->write(pfile,buff,count,ppos);
+	atomic64_add(ktime_get_ns() - start,&stat->ns);
+	atomic64_inc(&stat->calls);
+	if(ret > 0) atomic64_add(ret,&stat->bytes);
+	return ret;
+}
+
+static int general_open(struct inode * inode, struct file *pfile);
+static int general_close(struct inode * inode, struct file *pfile);
+static unsigned int general_poll(struct file *pfile, poll_table *wait);
+
+static unsigned int timed_poll(struct file *pfile, poll_table *wait)
+{
+	struct periph_slot *slot = file_slot(pfile);
+
+	if(!slot->fops->poll) return DEFAULT_POLLMASK;
+	return slot->fops->poll(pfile,wait);
+}
+
+// File operations used instead of the ones of the driver, when fop_stats is set.
+static struct file_operations timed_fops =
+{
+		.owner = THIS_MODULE,
+		.open = general_open,
+		.release = general_close,
+		.read = timed_read,
+		.write = timed_write,
+		.poll = timed_poll
+};
+
+static int general_open(struct inode * inode, struct file *pfile)
+{
+	int i;
+	struct periph_session *ss;
+
+	// Store a new session of the peripheral slot in the file structure, so that the read/write functions can reach the
+	// device bound to it.
+	for(i=0;i<PERIPH_ID_NUM;i++)
+	{
+		if(slots[i].major == imajor(inode))
+		{
+			if(!try_module_get(THIS_MODULE)) return -ENODEV;
+			ss = kmem_cache_zalloc(session_cache,GFP_KERNEL);
+			if(!ss)
+			{
+				module_put(THIS_MODULE);
+				return -ENOMEM;
+			}
+			ss->slot = &slots[i];
+			ss->pid = task_tgid_vnr(current);
+			ss->event_cursor = smp_load_acquire(&slots[i].event_head);
+			mutex_lock(&sessions_lock);
+			list_add_tail(&ss->node,&slots[i].sessions);
+			mutex_unlock(&sessions_lock);
+			pfile->private_data = ss;
+			return 0;
+		}
+	}
+	return -ENODEV;
+}
+
+
+static int general_close(struct inode * inode, struct file *pfile)
+{
+	struct periph_session *ss = pfile->private_data;
+
+	mutex_lock(&sessions_lock);
+	list_del(&ss->node);
+	mutex_unlock(&sessions_lock);
+	kmem_cache_free(session_cache,ss);
+	module_put(THIS_MODULE);
+	return 0;
+}
+
+/**
+ * general_poll - Reports the device readable, while the session has undelivered events. Polling subscribes the session
+ * to the events: its reads deliver them one by one.
+ *
+ * Error is reported while the peripheral is not available.
+ */
+static unsigned int general_poll(struct file *pfile, poll_table *wait)
+{
+	struct periph_session *ss = pfile->private_data;
+
+	ss->subscribed = true;
+	poll_wait(pfile,&ss->slot->event_wq,wait);
+	if(!READ_ONCE(ss->slot->data)) return POLLERR;
+	if(smp_load_acquire(&ss->slot->event_head) != ss->event_cursor) return POLLIN | POLLRDNORM;
+	return 0;
+}
+/******************************************************************************
+ * 							SWITCH DRIVER
+ ******************************************************************************/
+
+	///////////////////////// SWITCH FILE OPERATIONS ////////////////////////////////
+
+
+	/**
+	 * sw_read - Returns the state of the switches as a string containing 1-s and 0-s.
+	 */
+	static ssize_t sw_read (struct file *pfile, char __user *buff, size_t count, loff_t *ppos)
+	{
+		u32 val;
+		int i;
+		struct device_data *data;
+		struct periph_session *ss = pfile->private_data;
+		struct periph_event ev;
+
+		// The state is taken at the start of the read, the rest is served from the session.
+		if(*ppos == 0)
+		{
+			// Get the device from the file structure.
+			data = slot_get(ss->slot);
+			if(!data) return -EAGAIN;
+
+			// Subscribed sessions get the changes in order, the others the current state.
+			if(ss->subscribed && session_next_event(ss,&ev))
+				val = ev.val;
+			else
+			{
+				session_skip_events(ss);
+				val = pl_read32_cached(data,0);
+			}
+			slot_put(ss->slot);
+			// Convert the LSB to binary
+			for(i=0;i<8;i++)
+			{
+				ss->text[7-i] = '0'+val%2;
+				val /= 2;
+			}
+			ss->text[8] = 0;
+			ss->text_len = 9;
+		}
+		return session_read_text(ss,buff,count,ppos);
+	}
+
+	static ssize_t sw_write (struct file *pfile, const char __user *buff, size_t count, loff_t *ppos)
+	{
+
+		printk(KERN_ERR"Switch device is not writable.\n");
+		return 0;
+	}
+
+	static struct file_operations sw_fops =
+	{
+			.owner = THIS_MODULE,
+			.open = general_open,
+			.release = general_close,
+			.read = sw_read,
+			.write = sw_write,
+			.poll = general_poll
+	};
+
+///////////////////////// SW PLATFORM DRIVER FUNCTIONS ////////////////////////
+
+static int sw_probe(struct platform_device *pdev)
+{
+	// Locals
+	int retval;
+
+	retval = alloc_resources(pdev,PERIPH_ID_SW,"sw",1,&sw_fops);
+	if(retval) return retval;
+
+	slot_attach(pdev);
+	dev_dbg(&pdev->dev,"Switch driver loaded.\n");
+	return 0;
+}
+
+static int sw_remove(struct platform_device *pdev)
+{
+	return free_resources(pdev);
+}
+
+static struct of_device_id sw_match_table[]={
+		{.compatible = "xlnx,my-axi-sw-1.0"},{}
+};
+
+static struct platform_driver sw_driver={
+		.driver={
+				.name = "sw",
+				.owner = THIS_MODULE,
+				.of_match_table = sw_match_table,
+				.probe_type = PROBE_PREFER_ASYNCHRONOUS
+		},
+		.probe = sw_probe,
+		.remove = sw_remove
+};
+
+
+
+/*******************************************************************************
+ * 						Random number generator
+ *******************************************************************************/
+
+	///////////////////////// File operations /////////////////////////////////////
+
+	/// Maximum number of random numbers returned by one read.
+	#define RNG_READ_WORDS 128
+
+	/// Reads of at least this many numbers are transferred by DMA, if the device has a channel.
+	#define RNG_DMA_MIN_WORDS 64
+
+	/// Pages of the DMA buffer, the maximum of a DMA read is RNG_DMA_PAGES*PAGE_SIZE bytes.
+	#define RNG_DMA_PAGES 4
+
+	// Buffer of the DMA reads, scattered over single pages. Protected by the dma_lock of the device.
+	static struct page *rng_dma_pages[RNG_DMA_PAGES];
+	static struct scatterlist rng_dma_sg[RNG_DMA_PAGES];
+
+	/**
+	 * rng_dma_alloc - Allocates the DMA buffer at the first probe. It is kept until the module is unloaded.
+	 */
+	static bool rng_dma_alloc(void)
+	{
+		int i;
+
+		for(i=0;i<RNG_DMA_PAGES;i++)
+		{
+			if(!rng_dma_pages[i]) rng_dma_pages[i] = alloc_page(GFP_KERNEL);
+			if(!rng_dma_pages[i]) return false;
+		}
+		return true;
+	}
+
+	static void rng_dma_free(void)
+	{
+		int i;
+
+		for(i=0;i<RNG_DMA_PAGES;i++)
+		{
+			if(rng_dma_pages[i]) __free_page(rng_dma_pages[i]);
+			rng_dma_pages[i] = NULL;
+		}
+	}
+
+	/**
+	 * rng_read_dma - Transfers the random numbers from the data register into the pages, and copies them to the user.
+	 */
+	static ssize_t rng_read_dma(struct device_data *data, char __user *buff, size_t bytes)
+	{
+		struct dma_chan *chan = data->dma_chan;
+		struct dma_async_tx_descriptor *desc;
+		struct scatterlist *sg;
+		int i, nents, mapped;
+		ssize_t retval;
+
+		bytes = min_t(size_t,bytes,RNG_DMA_PAGES*PAGE_SIZE);
+		nents = DIV_ROUND_UP(bytes,PAGE_SIZE);
+
+		mutex_lock(&data->dma_lock);
+		sg_init_table(rng_dma_sg,nents);
+		for(i=0;i<nents;i++) sg_set_page(&rng_dma_sg[i],rng_dma_pages[i],min_t(size_t,bytes - i*PAGE_SIZE,PAGE_SIZE),0);
+
+		mapped = dma_map_sg(chan->device->dev,rng_dma_sg,nents,DMA_FROM_DEVICE);
+		if(!mapped)
+		{
+			retval = -ENOMEM;
+			goto out;
+		}
+		desc = dmaengine_prep_slave_sg(chan,rng_dma_sg,mapped,DMA_DEV_TO_MEM,DMA_PREP_INTERRUPT);
+		retval = desc ? pl_dma_run(data,desc) : -EIO;
+		dma_unmap_sg(chan->device->dev,rng_dma_sg,nents,DMA_FROM_DEVICE);
+		if(retval) goto out;
+
+		retval = bytes;
+		for_each_sg(rng_dma_sg,sg,nents,i)
+		{
+			if(copy_to_user(buff + i*PAGE_SIZE,sg_virt(sg),sg->length))
+			{
+				retval = -EFAULT;
+				break;
+			}
+		}
+	out:
+		mutex_unlock(&data->dma_lock);
+		return retval;
+	}
+
+	/**
+	 * rng_read - Fills the buffer with 16 bit random numbers, up to RNG_READ_WORDS of them, or up to the size of the DMA
+	 * buffer, if the device has a DMA channel.
+	 */
+	static ssize_t rng_read (struct file *pfile, char __user *buff, size_t count, loff_t *ppos)
+	{
+		u16 val[RNG_READ_WORDS];
+		size_t i, words;
+		ssize_t retval;
+		struct device_data *data;
+
+		// Return data only if there is enough place for them. No numbers are skipped this way.
+		if (count<2) return 0;
+
+		data = slot_get(file_slot(pfile));
+		if(!data) return -EAGAIN;
+		if(data->dma_chan && use_dma && count/2 >= RNG_DMA_MIN_WORDS)
+		{
+			retval = rng_read_dma(data,buff,count & ~1);
+			slot_put(file_slot(pfile));
+			((struct periph_session*)pfile->private_data)->reads++;
+			return retval;
+		}
+		words = min_t(size_t,count/2,RNG_READ_WORDS);
+		for(i=0;i<words;i++) val[i] = pl_read16(data,0);
+		slot_put(file_slot(pfile));
+
+		((struct periph_session*)pfile->private_data)->reads++;
+		if( copy_to_user(buff,val,words*2)) return -EFAULT;
+		else return words*2;
+	}
+
+	static ssize_t rng_write (struct file *pfile, const char __user *buff, size_t count, loff_t *ppos)
+	{
+
+		u32 val = 0;
+		struct device_data *data;
+
+		if(count==0) return 0;
+		if(copy_from_user((void*)&val,buff,count>2?2:count)) return -EFAULT;
+
+		printk(KERN_DEBUG"New random number generator seed: %d.\n",val);
+
+		data = slot_get(file_slot(pfile));
+		if(!data) return -EAGAIN;
+		pl_write32(data,0,val);
+		data->shadow[0] = val;
+		slot_put(file_slot(pfile));
+		((struct periph_session*)pfile->private_data)->writes++;
+		return count;
+	}
+
+	static struct file_operations rng_fops =
+	{
+			.owner = THIS_MODULE,
+			.open = general_open,
+			.release = general_close,
+			.read = rng_read,
+			.write = rng_write
+	};
+
+/////////////////////// Platform driver functions /////////////////////////////
+
+	static int rng_probe(struct platform_device *pdev)
+	{
+		int retval;
+		const u32 *regs;
+		struct device_data *data;
+		struct dma_slave_config cfg;
+
+		retval = alloc_resources(pdev,PERIPH_ID_RNG,"myrandom",1,&rng_fops);
+		if(retval) return retval;
+
+		// Reseed the generator, only if it was seeded before.
+		data = platform_get_drvdata(pdev);
+		regs = restore_snapshot(pdev);
+		if(regs && regs[0]) pl_write32(data,0,regs[0]);
+
+		// Bulk reads by DMA from the data register, if the overlay gives a channel.
+		if(rng_dma_alloc())
+		{
+			memset(&cfg,0,sizeof(cfg));
+			cfg.direction = DMA_DEV_TO_MEM;
+			cfg.src_addr = data->res.start;
+			cfg.src_addr_width = DMA_SLAVE_BUSWIDTH_2_BYTES;
+			cfg.src_maxburst = 1;
+			data->dma_chan = pl_dma_request(pdev,"rx",DMA_SLAVE,&cfg);
+		}
+
+		slot_attach(pdev);
+		dev_dbg(&pdev->dev,"Random number driver loaded.\n");
+		return 0;
+	}
+
+
+	static int rng_remove(struct platform_device *pdev)
+	{
+		return free_resources(pdev);
+	}
+
+
+	static struct of_device_id rng_match_table[]={
+			{.compatible = "xlnx,my-axi-random-1.0"},{}
+	};
+
+	static struct platform_driver rng_driver={
+			.driver={
+					.name = "random",
+					.owner = THIS_MODULE,
+					.of_match_table = rng_match_table,
+					.probe_type = PROBE_PREFER_ASYNCHRONOUS
+			},
+			.probe = rng_probe,
+			.remove = rng_remove
+	};
+
+
+
+/*******************************************************************************
+ * 						AXI TIMER DRIVER
+ *******************************************************************************/
+
+
+	/// Lowest accepted timer_min_period: 100 us, so that a small value written to the device cannot cause an interrupt storm.
+	#define TIMER_MIN_PERIOD_FLOOR 10000
+
+	static unsigned int timer_min_period = 100000;
+
+	/**
+	 * timer_min_period_set - Raises the values below TIMER_MIN_PERIOD_FLOOR to it. Writing 0 to the device always stops
+	 * the timer.
+	 */
+	static int timer_min_period_set(const char *val, const struct kernel_param *kp)
+	{
+		unsigned int period;
+		int ret = kstrtouint(val,0,&period);
+
+		if(ret) return ret;
+		*(unsigned int*)kp->arg = max_t(unsigned int,period,TIMER_MIN_PERIOD_FLOOR);
+		return 0;
+	}
+
+	static const struct kernel_param_ops timer_min_period_ops = {
+		.set = timer_min_period_set,
+		.get = param_get_uint,
+	};
+	module_param_cb(timer_min_period,&timer_min_period_ops,&timer_min_period,0644);
+	MODULE_PARM_DESC(timer_min_period,"Shortest period of the timer in clock cycles, smaller values written to the device stop the timer. At least 10000.");
+
+	static unsigned int timer_poll_rate = 0;
+	module_param(timer_poll_rate,uint,0644);
+	MODULE_PARM_DESC(timer_poll_rate,"Expiry rate of the timer (1/s), above which its interrupt is masked and the timer is polled. It returns to interrupts below the half of the rate. 0 uses only interrupts.");
+
+	static unsigned int timer_poll_us = 1000;
+	module_param(timer_poll_us,uint,0644);
+	MODULE_PARM_DESC(timer_poll_us,"Period of the polling of the timer.");
+
+	static unsigned int timer_poll_budget = 8;
+	module_param(timer_poll_budget,uint,0644);
+	MODULE_PARM_DESC(timer_poll_budget,"Maximum number of timer events reported to the sessions per poll, the other expiries are only counted.");
+
+	/// Window of the expiry rate measurement.
+	#define TIMER_RATE_WINDOW_NS (10*NSEC_PER_MSEC)
+
+	/// Minimum number of polls in a period of the hardware while polling, see timer_poll_mult.
+	#define TIMER_POLL_SPAN 4
+
+	// Interrupt or polling mode of the timer. The expiries are counted from the interrupt flag of the status register,
+	// never from the time of the readings. In polling mode the load register holds a multiple of the period, so that a
+	// period of the hardware spans several polls, and its flag cannot be set twice between two of them. The expiries
+	// inside the period of the hardware are given by the counter register. In interrupt mode every expiry raises its own
+	// interrupt, it has to be served within a period (at least TIMER_MIN_PERIOD_FLOOR cycles).
+	struct timer_adaptive{
+		spinlock_t lock;		// Serializes the accounting, and the events of the interrupt handler and the poll.
+		bool polling;
+		struct hrtimer poll_timer;
+		u32 period;			// Cycles between the expiries: load register + 2.
+		u32 mult;			// Expiries in the current period of the hardware.
+		u32 next_mult;			// Expiries in the period of the hardware after its next reload.
+		u32 counted;			// Expiries of the current period of the hardware, that are already counted.
+		u64 last_ns;			// Time of the last accounting, only for the trace.
+		u64 window_ns;			// Start of the rate measurement window.
+		u64 window_expiries;
+		u64 rate;			// Expiries per second, measured in the last window.
+
+		// Statistics
+		u64 expiries;
+		u64 irqs;
+		u64 polls;
+		u64 to_poll;			// Switches to polling.
+		u64 to_irq;			// Switches back to interrupts.
+		u64 coalesced;			// Expiries over the poll budget, not reported as events.
+	};
+	static struct timer_adaptive timer_adapt;
+
+	/**
+	 * timer_adaptive_start - Starts counting the expiries from the (re)load of the timer.
+	 * @load: Load register value.
+	 */
+	static void timer_adaptive_start(u32 load)
+	{
+		unsigned long flags;
+
+		spin_lock_irqsave(&timer_adapt.lock,flags);
+		timer_adapt.period = load + 2;
+		timer_adapt.mult = 1;
+		timer_adapt.next_mult = 1;
+		timer_adapt.counted = 0;
+		timer_adapt.last_ns = ktime_get_ns();
+		spin_unlock_irqrestore(&timer_adapt.lock,flags);
+	}
+
+	/**
+	 * timer_adaptive_stop - Stops the polling. The timer is started again with the interrupt enabled.
+	 */
+	static void timer_adaptive_stop(void)
+	{
+		unsigned long flags;
+
+		spin_lock_irqsave(&timer_adapt.lock,flags);
+		timer_adapt.polling = false;
+		spin_unlock_irqrestore(&timer_adapt.lock,flags);
+		hrtimer_cancel(&timer_adapt.poll_timer);
+	}
+
+	///////////////////////// File operations ///////////////////////////////////
+
+	/*
+	 * timer_read - Gives the interrupt period as ASCII string.
+	 */
+	static ssize_t timer_read (struct file *pfile, char __user *buff, size_t count, loff_t *ppos)
+	{
+		u32 period;
+		struct device_data *data;
+		struct periph_session *ss = pfile->private_data;
+
+		if(*ppos == 0)
+		{
+			data = slot_get(ss->slot);
+			if(!data) return -EAGAIN;
+			// A read acknowledges all the interrupts.
+			session_skip_events(ss);
+			period = pl_read32_cached(data,4);
+			slot_put(ss->slot);
+			ss->text_len = uint2str(period,ss->text,11);
+		}
+		return session_read_text(ss,buff,count,ppos);
+	}
+
+	/**
+	 * Resets the timer with the given value. If value is less then timer_min_period, timer is stopped. (Frquency is 100Mhz).
+	 */
+	static ssize_t timer_write (struct file *pfile, const char __user *buff, size_t count, loff_t *ppos)
+	{
+		u32 val;
+		char ks_str[11];
+		int ks_len;
+		struct device_data *data;
+
+		ks_len = count>10?10:count;
+		ks_str[ks_len] = 0;
+		if(copy_from_user(ks_str,buff,ks_len)) {return -EFAULT;}
+
+
+		// Convert input to u32.
+		val = str2int(ks_str,ks_len);
+
+		printk(KERN_DEBUG"Value converted: %d.\n",val);
+
+		data = slot_get(file_slot(pfile));
+		if(!data) return -EAGAIN;
+		timer_adaptive_stop();
+		if(val < timer_min_period)
+		{
+			//Stop timer
+			pl_write32(data,0,0x172);
+			data->shadow[0] = 0x172;
+			printk(KERN_DEBUG"AXI timer is stopped, because period %d is too small.(It should be greater or equal than %u.)\n",val,timer_min_period);
+		}
+		else
+		{
+			// Set reset value ad reset the timer.
+			pl_write32(data,4,val);		// Set reset value
+			pl_write32(data,0,0x172);	// Reset timer
+			pl_write32(data,0,0x1D2);	// Start timer
+			timer_adaptive_start(val);
+			data->shadow[0] = 0x1D2;
+			data->shadow[1] = val;
+			reg_cache_update(data,4,val,true);
+			printk(KERN_DEBUG"AXI Timer is reseted with period: %d.\n",val);
+		}
+		slot_put(file_slot(pfile));
+		((struct periph_session*)pfile->private_data)->writes++;
+		return count;
+	}
+
+
+	static struct file_operations timer_fops=
+	{
+			.owner = THIS_MODULE,
+			.open = general_open,
+			.release = general_close,
+			.read = timer_read,
+			.write = timer_write,
+			.poll = general_poll
+	};
+
+	////////////////////////////// interrupt handler /////////////////////////////
+	static int irq_num;
+	static struct device_data *timer_dev;
+
+	/**
+	 * timer_account - Counts the expiries since the last call, and clears the interrupt flag. Called with the lock held.
+	 * @csr: Returns the status register.
+	 *
+	 * A set flag ends the current period of the hardware: its expiries not counted yet are added. The expiries inside
+	 * the new period are the multiples of the period, that the counter has passed.
+	 */
+	static u64 timer_account(struct timer_adaptive *ta, u32 *csr)
+	{
+		u32 before = pl_read32(timer_dev,0);
+		u32 count = pl_read32(timer_dev,8);
+		u32 passed;
+		u64 now = ktime_get_ns();
+		u64 expiries = 0;
+
+		*csr = pl_read32(timer_dev,0);
+		// Reloaded between the readings, the counter is read again from the new period.
+		if((before ^ *csr) & TCSR_TINT) count = pl_read32(timer_dev,8);
+		if(*csr & TCSR_TINT)
+		{
+			pl_write32(timer_dev,0,*csr & ~TCSR_LOAD);
+			expiries = ta->mult - ta->counted;
+			ta->mult = ta->next_mult;
+			ta->counted = 0;
+		}
+		if(ta->mult > 1)
+		{
+			// Down counter from mult*period - 2, the last expiry of the period is the reload.
+			passed = (ta->mult*ta->period - 2 - min_t(u32,count,ta->mult*ta->period - 2)) / ta->period;
+			passed = min_t(u32,passed,ta->mult - 1);
+			if(passed > ta->counted)
+			{
+				expiries += passed - ta->counted;
+				ta->counted = passed;
+			}
+		}
+		ta->expiries += expiries;
+		ta->window_expiries += expiries;
+		if(expiries) trace_pl_timer_tick(ta->expiries,expiries,now - ta->last_ns,div_u64((u64)ta->period * NSEC_PER_SEC,PL_CLK_HZ),ta->polling);
+		ta->last_ns = now;
+		return expiries;
+	}
+
+	/**
+	 * timer_report - Reports at most timer_poll_budget expiries to the sessions. Called with the lock held.
+	 */
+	static void timer_report(struct timer_adaptive *ta, u64 expiries, u32 csr)
+	{
+		u64 i;
+
+		if(expiries > timer_poll_budget)
+		{
+			ta->coalesced += expiries - timer_poll_budget;
+			expiries = timer_poll_budget;
+		}
+		for(i=0;i<expiries;i++) slot_event(&slots[PERIPH_ID_TIMER],csr | TCSR_TINT);
+	}
+
+	/**
+	 * timer_poll_mult - Gives the number of expiries in a period of the hardware while polling, so that the period spans
+	 * TIMER_POLL_SPAN polls. The load register has to fit into 32 bits.
+	 */
+	static u32 timer_poll_mult(u32 period)
+	{
+		u64 mult = div_u64((u64)TIMER_POLL_SPAN * timer_poll_us * (PL_CLK_HZ/1000000) + period - 1,period);
+
+		return clamp_t(u64,mult,1,U32_MAX/period);
+	}
+
+	/**
+	 * timer_rate_update - Updates the expiry rate at the end of the measurement window. Called with the lock held.
+	 *
+	 * Returns true, if a new rate is measured.
+	 */
+	static bool timer_rate_update(struct timer_adaptive *ta)
+	{
+		u64 now = ktime_get_ns();
+
+		if(now - ta->window_ns < TIMER_RATE_WINDOW_NS) return false;
+		ta->rate = div64_u64(ta->window_expiries * NSEC_PER_SEC,now - ta->window_ns);
+		ta->window_ns = now;
+		ta->window_expiries = 0;
+		return true;
+	}
+
+	static void pipeline_tick(u64 expiries, u32 period);
+
+	// Interrupt handler. The expiries are only counted, the sessions and the pipeline are served from here.
+	irqreturn_t timer_irq_handler(int irq, void *dev_id)
+	{
+		struct timer_adaptive *ta = &timer_adapt;
+		unsigned long flags;
+		u64 expiries;
+		u32 period, csr;
+
+		spin_lock_irqsave(&ta->lock,flags);
+		ta->irqs++;
+		expiries = timer_account(ta,&csr);
+		period = ta->period;
+		timer_report(ta,expiries,csr);
+		if(timer_rate_update(ta) && timer_poll_rate && ta->rate > timer_poll_rate && !ta->polling)
+		{
+			// Mask the interrupt, the next expiries are counted by the poll. The longer period of the hardware starts
+			// at its next reload.
+			ta->next_mult = timer_poll_mult(period);
+			pl_write32(timer_dev,4,ta->next_mult*period - 2);
+			pl_write32(timer_dev,0,csr & ~(TCSR_ENIT | TCSR_TINT | TCSR_LOAD));
+			ta->polling = true;
+			ta->to_poll++;
+			hrtimer_start(&ta->poll_timer,ns_to_ktime((u64)timer_poll_us * NSEC_PER_USEC),HRTIMER_MODE_REL);
+		}
+		spin_unlock_irqrestore(&ta->lock,flags);
+
+		if(expiries) pipeline_tick(expiries,period);
+		return IRQ_HANDLED;
+	}
+
+	/**
+	 * timer_poll - Counts the expiries while the interrupt is masked, and reports at most timer_poll_budget of them to
+	 * the sessions. Unmasks the interrupt, when the rate falls below the half of timer_poll_rate.
+	 */
+	static enum hrtimer_restart timer_poll(struct hrtimer *timer)
 	{
-			.owner = THIS_MODULE,
-			.open = general_open,
-			.release = general_close,
-			.read = sw_read,
-			.write = sw_write
+		struct timer_adaptive *ta = container_of(timer,struct timer_adaptive,poll_timer);
+		unsigned long flags;
+		u64 expiries;
+		u32 csr, period;
+		bool done;
+
+		spin_lock_irqsave(&ta->lock,flags);
+		if(!ta->polling)
+		{
+			spin_unlock_irqrestore(&ta->lock,flags);
+			return HRTIMER_NORESTART;
+		}
+		ta->polls++;
+		expiries = timer_account(ta,&csr);
+		period = ta->period;
+		timer_report(ta,expiries,csr);
+
+		done = timer_rate_update(ta) && (!timer_poll_rate || ta->rate < timer_poll_rate/2);
+		if(done)
+		{
+			// The interrupt ending the current period of the hardware counts its remaining expiries. From then on
+			// every expiry raises an interrupt.
+			ta->polling = false;
+			ta->to_irq++;
+			ta->next_mult = 1;
+			pl_write32(timer_dev,4,period - 2);
+			pl_write32(timer_dev,0,(csr | TCSR_ENIT) & ~(TCSR_TINT | TCSR_LOAD));
+		}
+		spin_unlock_irqrestore(&ta->lock,flags);
+		if(expiries) pipeline_tick(expiries,period);
+
+		if(done) return HRTIMER_NORESTART;
+		hrtimer_forward_now(timer,ns_to_ktime((u64)timer_poll_us * NSEC_PER_USEC));
+		return HRTIMER_RESTART;
+	}
+
+/////////////////////////////// Platform driver functions ////////////////////////
+
+	static int timer_probe(struct platform_device *pdev)
+	{
+		// Locals
+		int retval;
+		const u32 *regs;
+		struct device_data *data;
+
+		retval = alloc_resources(pdev,PERIPH_ID_TIMER,"mytimer",1,&timer_fops);
+		if(retval) return retval;
+
+		data = (struct device_data*)platform_get_drvdata(pdev);
+		timer_dev = data;
+		hrtimer_init(&timer_adapt.poll_timer,CLOCK_MONOTONIC,HRTIMER_MODE_REL);
+		timer_adapt.poll_timer.function = timer_poll;
+		timer_adapt.polling = false;
+
+		// Registering interrupt handler. The simulated timer calls the handler directly.
+		if(!simulate && request_irq(data->irq_num,timer_irq_handler,0,"AXI_TIMER",NULL))
+		{
+			printk(KERN_ERR"The interrupt %d is already taken.\n",irq_num);
+			retval = -EBUSY;
+			goto err0;
+		}
+
+		// Restart the timer with the saved period, if it was running.
+		regs = restore_snapshot(pdev);
+		if(regs && regs[0] == 0x1D2)
+		{
+			pl_write32(data,4,regs[1]);
+			pl_write32(data,0,0x172);
+			pl_write32(data,0,0x1D2);
+			timer_adaptive_start(regs[1]);
+			reg_cache_update(data,4,regs[1],true);
+		}
+
+		slot_attach(pdev);
+		dev_dbg(&pdev->dev,"AXI timer driver loaded.\n");
+		return 0;
+
+		err0:
+			free_resources(pdev);
+		return retval;
+	}
+
+	static int timer_remove(struct platform_device *pdev)
+	{
+		struct device_data *data = (struct device_data*)platform_get_drvdata(pdev);
+		if(!data) return 0;
+
+		// Stop the simulated timer, before the poll is stopped.
+		if(simulate) model_exit(data);
+		else free_irq(data->irq_num,NULL);
+		timer_adaptive_stop();
+		return free_resources(pdev);
+	}
+
+	static struct of_device_id timer_match_table[]={
+			{.compatible =  "xlnx,xps-timer-1.00.a"},{}
 	};
 
-///////////////////////// SW PLATFORM DRIVER FUNCTIONS ////////////////////////
 
-static int sw_probe(struct platform_device *pdev)
+	static struct platform_driver timer_driver={
+			.driver={
+					.name = "timer",
+					.owner = THIS_MODULE,
+					.of_match_table = timer_match_table,
+					.probe_type = PROBE_PREFER_ASYNCHRONOUS
+			},
+			.probe = timer_probe,
+			.remove = timer_remove
+	};
+/*******************************************************************************
+ * 						LED_PWM DRIVER
+ *******************************************************************************/
+
+
+		static unsigned int pwm_max_duty = 100000;
+		module_param(pwm_max_duty,uint,0444);
+		MODULE_PARM_DESC(pwm_max_duty,"Duty register value of the full brightness. The PWM counter of the IP counts to 100000.");
+
+		/// Period of the PWM signal: 100000 cycles of the PL clock.
+		#define LED_PWM_PERIOD_NS 1000000
+
+		// Serializes the duty registers and their shadow between the file and class writes, the step timer of the
+		// sequences and the pipeline.
+		static DEFINE_SPINLOCK(led_pwm_lock);
+
+		/**
+		 * led_pwm_set_locked - Sets the duty register of a channel. Called with led_pwm_lock held.
+		 */
+		static void led_pwm_set_locked(struct device_data *data, int ch, u32 val)
+		{
+			pl_write32(data,ch*4,val);
+			data->shadow[ch] = val;
+			reg_cache_update(data,ch*4,val,true);
+		}
+
+		/**
+		 * led_pwm_set - Sets the duty register of a channel.
+		 */
+		static void led_pwm_set(struct device_data *data, int ch, u32 val)
+		{
+			unsigned long flags;
+
+			spin_lock_irqsave(&led_pwm_lock,flags);
+			led_pwm_set_locked(data,ch,val);
+			spin_unlock_irqrestore(&led_pwm_lock,flags);
+		}
+
+		static unsigned int pwm_seq_step_us = 0;
+		module_param(pwm_seq_step_us,uint,0644);
+		MODULE_PARM_DESC(pwm_seq_step_us,"Time between the frames of a PWM sequence. 0 writes the frames back to back, the last one stays.");
+
+		static struct file_operations led_pwm_fops;
+
+		/// Maximum number of frames of a PWM sequence.
+		#define PWM_SEQ_FRAMES 1024
+
+		// Duty table written to a led_pwm device: frames of the 8 duty values, played in order. The frames are
+		// transferred by DMA into the duty registers, if the overlay gives a channel.
+		struct led_pwm_seq{
+			struct device_data *data;
+			u32 (*frames)[8];
+			unsigned int len;		// Number of frames of the sequence.
+			unsigned int pos;		// Next frame to be played.
+			dma_addr_t frames_dma;		// Mapping of the frames, while mapped is set.
+			bool mapped;
+			struct hrtimer step;
+		};
+		static struct led_pwm_seq led_pwm_seq;
+
+		static struct dma_async_tx_descriptor *led_pwm_seq_desc(struct led_pwm_seq *seq, unsigned int i, unsigned long flags)
+		{
+			return dmaengine_prep_dma_memcpy(seq->data->dma_chan,seq->data->res.start,
+					seq->frames_dma + i*sizeof(seq->frames[0]),sizeof(seq->frames[0]),flags);
+		}
+
+		/**
+		 * led_pwm_seq_shadow - Updates the shadow registers and the cache to the frame. Called with led_pwm_lock held.
+		 */
+		static void led_pwm_seq_shadow(struct led_pwm_seq *seq, unsigned int i)
+		{
+			int ch;
+
+			for(ch=0;ch<8;ch++)
+			{
+				seq->data->shadow[ch] = seq->frames[i][ch];
+				reg_cache_update(seq->data,ch*4,seq->frames[i][ch],true);
+			}
+		}
+
+		/**
+		 * led_pwm_seq_frame - Writes the frame into the duty registers. The DMA transfer is only issued, it is not
+		 * waited for. Called also from the step timer.
+		 */
+		static void led_pwm_seq_frame(struct led_pwm_seq *seq, unsigned int i)
+		{
+			struct dma_async_tx_descriptor *desc = seq->mapped ? led_pwm_seq_desc(seq,i,0) : NULL;
+			unsigned long flags;
+			int ch;
+
+			spin_lock_irqsave(&led_pwm_lock,flags);
+			if(desc && !dma_submit_error(dmaengine_submit(desc)))
+				dma_async_issue_pending(seq->data->dma_chan);
+			else
+				for(ch=0;ch<8;ch++) pl_write32(seq->data,ch*4,seq->frames[i][ch]);
+			led_pwm_seq_shadow(seq,i);
+			spin_unlock_irqrestore(&led_pwm_lock,flags);
+		}
+
+		static enum hrtimer_restart led_pwm_seq_step(struct hrtimer *timer)
+		{
+			struct led_pwm_seq *seq = container_of(timer,struct led_pwm_seq,step);
+
+			led_pwm_seq_frame(seq,seq->pos++);
+			if(seq->pos == seq->len) return HRTIMER_NORESTART;
+			hrtimer_forward_now(timer,ns_to_ktime((u64)pwm_seq_step_us * NSEC_PER_USEC));
+			return HRTIMER_RESTART;
+		}
+
+		/**
+		 * led_pwm_seq_stop - Stops the sequence being played, and releases its mapping. Called with the dma_lock held.
+		 */
+		static void led_pwm_seq_stop(struct led_pwm_seq *seq)
+		{
+			struct device_data *data = seq->data;
+
+			hrtimer_cancel(&seq->step);
+			if(!data || !seq->mapped) return;
+			dmaengine_terminate_all(data->dma_chan);
+			dma_unmap_single(data->dma_chan->device->dev,seq->frames_dma,seq->len * sizeof(seq->frames[0]),DMA_TO_DEVICE);
+			seq->mapped = false;
+		}
+
+		/**
+		 * led_pwm_seq_write - Plays the duty table on the led_pwm device. A new table replaces the one being played.
+		 * @count: Whole frames, at most PWM_SEQ_FRAMES.
+		 */
+		static ssize_t led_pwm_seq_write(struct device_data *data, const char __user *buff, size_t count)
+		{
+			struct led_pwm_seq *seq = &led_pwm_seq;
+			struct device *dma_dev;
+			struct dma_async_tx_descriptor *desc;
+			unsigned long flags;
+			unsigned int i;
+			ssize_t retval = 0;
+
+			mutex_lock(&data->dma_lock);
+			// After a swap the slot of the PWM may be bound to the generic driver, that has no sequence.
+			if(data->fops != &led_pwm_fops)
+			{
+				retval = -EAGAIN;
+				goto out;
+			}
+			led_pwm_seq_stop(seq);
+			seq->data = data;
+			seq->len = count / sizeof(seq->frames[0]);
+			if(copy_from_user(seq->frames,buff,seq->len * sizeof(seq->frames[0])))
+			{
+				retval = -EFAULT;
+				goto out;
+			}
+
+			if(data->dma_chan && use_dma)
+			{
+				dma_dev = data->dma_chan->device->dev;
+				seq->frames_dma = dma_map_single(dma_dev,seq->frames,seq->len * sizeof(seq->frames[0]),DMA_TO_DEVICE);
+				seq->mapped = !dma_mapping_error(dma_dev,seq->frames_dma);
+			}
+
+			if(pwm_seq_step_us)
+			{
+				seq->pos = 0;
+				hrtimer_start(&seq->step,ktime_set(0,0),HRTIMER_MODE_REL);
+			}
+			else if(seq->mapped)
+			{
+				// All the frames in one batch, only the last one is waited for.
+				for(i=0;i<seq->len;i++)
+				{
+					desc = led_pwm_seq_desc(seq,i,i+1 == seq->len ? DMA_PREP_INTERRUPT : 0);
+					if(!desc) retval = -EIO;
+					else if(i+1 == seq->len) retval = pl_dma_run(data,desc);
+					else if(dma_submit_error(dmaengine_submit(desc))) retval = -EIO;
+					if(retval) goto out;
+				}
+				spin_lock_irqsave(&led_pwm_lock,flags);
+				led_pwm_seq_shadow(seq,seq->len-1);
+				spin_unlock_irqrestore(&led_pwm_lock,flags);
+			}
+			else
+				for(i=0;i<seq->len;i++) led_pwm_seq_frame(seq,i);
+			retval = seq->len * sizeof(seq->frames[0]);
+		out:
+			mutex_unlock(&data->dma_lock);
+			return retval;
+		}
+
+///////////////// LED PWM File operations module //////////////////////////////
+
+		/**
+		 * led_pwm_read - Returns the brightness of the leds as an ASCII string.
+		 */
+		static ssize_t led_pwm_read (struct file *pfile, char __user *buff, size_t count, loff_t *ppos)
+		{
+			//Locals
+			int minor;
+			u32 pwm_val;
+			struct device_data *data;
+			struct periph_session *ss = pfile->private_data;
+
+			// Getting the minor number, it tells, which led should be modified.
+			minor = MINOR(pfile->f_inode->i_rdev);
+
+			if(*ppos == 0)
+			{
+				data = slot_get(ss->slot);
+				if(!data) return -EAGAIN;
+				pwm_val = pl_read32_cached(data,minor*4);
+				slot_put(ss->slot);
+				ss->text_len = uint2str(pwm_val,ss->text,11);
+			}
+			return session_read_text(ss,buff,count,ppos);
+		}
+
+		/**
+		 * led_pwm_write - Sets the brightness of the leds. The duty tables are written to /dev/pl_pwm_seq.
+		 */
+		static ssize_t led_pwm_write (struct file *pfile, const char __user *buff, size_t count, loff_t *ppos)
+		{
+			int minor;
+
+			char str[11];
+			int len;
+			u32 val = 0;
+			struct device_data *data;
+
+			// Getting minor number
+			minor = MINOR(pfile->f_inode->i_rdev);
+
+			len = count>10?10:count;
+			if(copy_from_user(str,buff,len)) return -EFAULT;
+			str[len] = 0;
+
+			val = str2int(str,len);
+
+			// write the value to the register
+			data = slot_get(file_slot(pfile));
+			if(!data) return -EAGAIN;
+			led_pwm_set(data,minor,val);
+			slot_put(file_slot(pfile));
+			((struct periph_session*)pfile->private_data)->writes++;
+
+			return count;
+		}
+
+		static struct file_operations led_pwm_fops=
+		{
+				.owner = THIS_MODULE,
+				.read = led_pwm_read,
+				.write = led_pwm_write,
+				.open = general_open,
+				.release = general_close
+		};
+
+		/**
+		 * pwm_seq_write - Plays a duty table on the PWM peripheral: frames of the 8 duty values (u32), see
+		 * led_pwm_seq_write. The write has to hold whole frames, at most PWM_SEQ_FRAMES of them.
+		 */
+		static ssize_t pwm_seq_write(struct file *pfile, const char __user *buff, size_t count, loff_t *ppos)
+		{
+			struct device_data *data;
+			ssize_t retval;
+
+			if(count == 0 || count % sizeof(led_pwm_seq.frames[0])) return -EINVAL;
+			if(count > PWM_SEQ_FRAMES * sizeof(led_pwm_seq.frames[0])) return -EFBIG;
+
+			data = slot_get(&slots[PERIPH_ID_PWM]);
+			if(!data) return -EAGAIN;
+			retval = led_pwm_seq.frames ? led_pwm_seq_write(data,buff,count) : -ENOMEM;
+			slot_put(&slots[PERIPH_ID_PWM]);
+			return retval;
+		}
+
+		static const struct file_operations pwm_seq_fops = {
+			.owner = THIS_MODULE,
+			.write = pwm_seq_write,
+			.llseek = no_llseek,
+		};
+
+		// Binary interface of the duty tables, besides the ASCII nodes of the channels.
+		static struct miscdevice pwm_seq_miscdev = {
+			.minor = MISC_DYNAMIC_MINOR,
+			.name = "pl_pwm_seq",
+			.fops = &pwm_seq_fops,
+		};
+		static bool pwm_seq_registered;
+
+///////////////////////////// LED and PWM class devices /////////////////////////////////////
+
+		struct led_pwm_classes;
+
+		// One channel as LED class device.
+		struct led_pwm_led{
+			struct led_classdev cdev;
+			struct led_pwm_classes *classes;
+			int ch;
+			bool registered;
+		};
+
+		// Kernel interfaces of the channels, besides the character devices. The LED triggers and the PWM consumers
+		// write the same duty registers as the character devices, the last write wins.
+		struct led_pwm_classes{
+			struct device_data *data;
+			bool removing;		// Ignore the writes at unregistration, the duty values are saved for the next probe.
+			struct led_pwm_led leds[8];
+			struct pwm_chip chip;
+			bool chip_added;
+			bool enabled[8];	// State of the PWM channels.
+			u32 duty[8];		// Duty of the PWM channels, written to the register when enabled.
+		};
+		static struct led_pwm_classes *led_pwm_dev;
+
+		/**
+		 * led_pwm_brightness_set - Scales the brightness to the duty range. Called also from atomic context by the triggers.
+		 */
+		static void led_pwm_brightness_set(struct led_classdev *cdev, enum led_brightness brightness)
+		{
+			struct led_pwm_led *led = container_of(cdev,struct led_pwm_led,cdev);
+
+			if(led->classes->removing) return;
+			led_pwm_set(led->classes->data,led->ch,div_u64((u64)brightness * pwm_max_duty,cdev->max_brightness));
+		}
+
+		static enum led_brightness led_pwm_brightness_get(struct led_classdev *cdev)
+		{
+			struct led_pwm_led *led = container_of(cdev,struct led_pwm_led,cdev);
+
+			return div_u64((u64)led->classes->data->shadow[led->ch] * cdev->max_brightness + pwm_max_duty/2,pwm_max_duty);
+		}
+
+		/**
+		 * led_pwm_config - Sets the duty cycle of a channel. The period of the IP is fixed, the duty is scaled to the
+		 * requested period.
+		 */
+		static int led_pwm_config(struct pwm_chip *chip, struct pwm_device *pwm, int duty_ns, int period_ns)
+		{
+			struct led_pwm_classes *classes = container_of(chip,struct led_pwm_classes,chip);
+			u32 duty;
+
+			if(classes->removing) return -ENODEV;
+			if(period_ns <= 0 || duty_ns < 0 || duty_ns > period_ns) return -EINVAL;
+			duty = div_u64((u64)duty_ns * pwm_max_duty,period_ns);
+			classes->duty[pwm->hwpwm] = duty;
+			if(classes->enabled[pwm->hwpwm]) led_pwm_set(classes->data,pwm->hwpwm,duty);
+			return 0;
+		}
+
+		static int led_pwm_enable(struct pwm_chip *chip, struct pwm_device *pwm)
+		{
+			struct led_pwm_classes *classes = container_of(chip,struct led_pwm_classes,chip);
+
+			if(classes->removing) return -ENODEV;
+			classes->enabled[pwm->hwpwm] = true;
+			led_pwm_set(classes->data,pwm->hwpwm,classes->duty[pwm->hwpwm]);
+			return 0;
+		}
+
+		static void led_pwm_disable(struct pwm_chip *chip, struct pwm_device *pwm)
+		{
+			struct led_pwm_classes *classes = container_of(chip,struct led_pwm_classes,chip);
+
+			if(classes->removing) return;
+			classes->enabled[pwm->hwpwm] = false;
+			led_pwm_set(classes->data,pwm->hwpwm,0);
+		}
+
+		static const struct pwm_ops led_pwm_ops = {
+			.config = led_pwm_config,
+			.enable = led_pwm_enable,
+			.disable = led_pwm_disable,
+			.owner = THIS_MODULE,
+		};
+
+		/**
+		 * led_pwm_register_classes - Registers the channels as LED class devices and as a PWM chip.
+		 *
+		 * The character devices work without them, so a failure is only reported.
+		 */
+		static void led_pwm_register_classes(struct platform_device *pdev)
+		{
+			int i;
+			int retval;
+			struct led_pwm_led *led;
+
+			led_pwm_dev = kzalloc(sizeof(*led_pwm_dev),GFP_KERNEL);
+			if(!led_pwm_dev)
+			{
+				printk(KERN_ERR"Insufficient memory for the LED and PWM devices.\n");
+				return;
+			}
+			led_pwm_dev->data = platform_get_drvdata(pdev);
+
+			for(i=0;i<8;i++)
+			{
+				led = &led_pwm_dev->leds[i];
+				led->classes = led_pwm_dev;
+				led->ch = i;
+				led->cdev.name = kasprintf(GFP_KERNEL,"led_pwm%d",i);
+				led->cdev.max_brightness = LED_FULL;
+				// Start from the duty restored after the swap.
+				led->cdev.brightness = led_pwm_brightness_get(&led->cdev);
+				led->cdev.brightness_set = led_pwm_brightness_set;
+				led->cdev.brightness_get = led_pwm_brightness_get;
+				led->cdev.flags = LED_HW_PLUGGABLE;
+				if(!led->cdev.name) continue;
+				retval = led_classdev_register(&pdev->dev,&led->cdev);
+				if(retval)
+					printk(KERN_ERR"Cannot register LED %s: %d.\n",led->cdev.name,retval);
+				else
+					led->registered = true;
+			}
+
+			for(i=0;i<8;i++)
+			{
+				led_pwm_dev->duty[i] = led_pwm_dev->data->shadow[i];
+				led_pwm_dev->enabled[i] = led_pwm_dev->duty[i] != 0;
+			}
+			led_pwm_dev->chip.dev = &pdev->dev;
+			led_pwm_dev->chip.ops = &led_pwm_ops;
+			led_pwm_dev->chip.base = -1;
+			led_pwm_dev->chip.npwm = 8;
+			retval = pwmchip_add(&led_pwm_dev->chip);
+			if(retval)
+				printk(KERN_ERR"Cannot register PWM chip: %d.\n",retval);
+			else
+				led_pwm_dev->chip_added = true;
+		}
+
+		static void led_pwm_unregister_classes(void)
+		{
+			int i;
+
+			if(!led_pwm_dev) return;
+			led_pwm_dev->removing = true;
+			for(i=0;i<8;i++)
+			{
+				if(led_pwm_dev->leds[i].registered) led_classdev_unregister(&led_pwm_dev->leds[i].cdev);
+				kfree(led_pwm_dev->leds[i].cdev.name);
+			}
+			// The PWM core keeps the chip while a consumer holds a channel. It is left behind with inactive operations.
+			if(led_pwm_dev->chip_added && pwmchip_remove(&led_pwm_dev->chip))
+				printk(KERN_ERR"PWM channels are still in use, the PWM chip is not removed.\n");
+			else
+				kfree(led_pwm_dev);
+			led_pwm_dev = NULL;
+		}
+
+///////////////////////////////// LED_PWM Platform driver functions  /////////////////////////////////////////////
+
+static int led_pwm_probe(struct platform_device *pdev)
 {
 	// Locals
 	int retval;
+	int i;
+	const u32 *regs;
+	struct device_data *data;
 
-	printk(KERN_DEBUG"Probing switch driver.\n");
-	retval = alloc_resources(pdev,"sw",1,&sw_fops);
+	retval = alloc_resources(pdev,PERIPH_ID_PWM,"led_pwm",8,&led_pwm_fops);
 	if(retval) return retval;
 
-	printk(KERN_INFO"Switch driver loaded.\n");
+	// Restore the duty values of the channels.
+	data = platform_get_drvdata(pdev);
+	regs = restore_snapshot(pdev);
+	if(regs)
+	{
+		for(i=0;i<8;i++)
+		{
+			pl_write32(data,i*4,regs[i]);
+			reg_cache_update(data,i*4,regs[i],true);
+		}
+	}
+
+	// Duty tables are transferred by DMA, if the overlay gives a channel.
+	if(!led_pwm_seq.frames) led_pwm_seq.frames = kmalloc(PWM_SEQ_FRAMES * sizeof(led_pwm_seq.frames[0]),GFP_KERNEL);
+	led_pwm_seq.data = data;
+	led_pwm_seq.mapped = false;
+	hrtimer_init(&led_pwm_seq.step,CLOCK_MONOTONIC,HRTIMER_MODE_REL);
+	led_pwm_seq.step.function = led_pwm_seq_step;
+	data->dma_chan = pl_dma_request(pdev,"tx",DMA_MEMCPY,NULL);
+
+	led_pwm_register_classes(pdev);
+	slot_attach(pdev);
+	dev_dbg(&pdev->dev,"PWM led driver loaded.\n");
 	return 0;
 }
 
-static int sw_remove(struct platform_device *pdev)
+int led_pwm_remove(struct platform_device *pdev)
 {
+	struct device_data *data = platform_get_drvdata(pdev);
+
+	if(data)
+	{
+		mutex_lock(&data->dma_lock);
+		led_pwm_seq_stop(&led_pwm_seq);
+		// The device is freed, the next sequence is set up by its writer.
+		if(led_pwm_seq.data == data) led_pwm_seq.data = NULL;
+		mutex_unlock(&data->dma_lock);
+	}
+	led_pwm_unregister_classes();
 	return free_resources(pdev);
 }
 
-static struct of_device_id sw_match_table[]={
-		{.compatible = "xlnx,my-axi-sw-1.0"},{}
+static struct of_device_id led_pwm_match_table[]={
+		{.compatible = "xlnx,my-axi-pwm-1.0"},{}
 };
 
-static struct platform_driver sw_driver={
+static struct platform_driver led_pwm_driver={
 		.driver={
-				.name = "sw",
+				.name = "led_pwm",
 				.owner = THIS_MODULE,
-				.of_match_table = sw_match_table
+				.of_match_table = led_pwm_match_table,
+				.probe_type = PROBE_PREFER_ASYNCHRONOUS
 		},
-		.probe = sw_probe,
-		.remove = sw_remove
+		.probe = led_pwm_probe,
+		.remove = led_pwm_remove
 };
+/*******************************************************************************
+ * 						CONTROL PIPELINE
+ *******************************************************************************/
+
+	/*
+	 * Control loop closed in the kernel: on every tick of the AXI timer the switches are sampled, their state selects
+	 * a row of the lookup table, and the row is written into the duty registers of the PWM. The table is uploaded to
+	 * /dev/pl_pipeline as 256 rows of the 8 duty values (u32), indexed by the state of the switches. Without an
+	 * uploaded table switch n turns channel n on at full brightness.
+	 *
+	 * The pipeline runs in the interrupt handler of the timer, or in its poll, while the timer, the switches and the
+	 * PWM are all bound, e.g. in simulation mode. It overrides the other writers of the duty registers.
+	 */
+
+	static bool pipeline_enable = false;
+	module_param(pipeline_enable,bool,0644);
+	MODULE_PARM_DESC(pipeline_enable,"Run the switch to PWM pipeline on every tick of the timer.");
+
+	/// Number of switch states, the rows of the lookup table.
+	#define PIPELINE_LUT_ROWS 256
+
+	struct pipeline_lut{
+		struct rcu_head rcu;
+		u32 duty[PIPELINE_LUT_ROWS][8];
+	};
 
+	// Stages of a tick
+	enum {PIPELINE_SAMPLE, PIPELINE_MAP, PIPELINE_ACTUATE, PIPELINE_STAGES};
 
+	struct pipeline_stage{
+		u64 count;
+		u64 total_ns;
+		u64 max_ns;
+	};
 
-/*******************************************************************************
- * 						Random number generator
- *******************************************************************************/
+	struct pipeline_state{
+		spinlock_t lock;			// Serializes the ticks and the statistics.
+		struct pipeline_lut __rcu *lut;		// Replaced under lut_lock, NULL for the default mapping.
+		struct mutex lut_lock;
+
+		// Statistics
+		struct pipeline_stage stage[PIPELINE_STAGES + 1];	// The last one is the whole tick.
+		u64 ticks;
+		u64 missed;			// Expiries not processed: several expiries per poll or late interrupt.
+		u64 overruns;			// Ticks longer than the timer period.
+		u64 unavailable;		// Ticks, when the switches or the PWM were not bound.
+		u64 writes;			// Duty registers written.
+		atomic64_t busy;		// Ticks dropped, because the previous one was still running on an other CPU.
+	};
+	static struct pipeline_state pipeline;
 
-	///////////////////////// File operations /////////////////////////////////////
+	static void pipeline_stage_add(struct pipeline_stage *stage, u64 ns)
+	{
+		stage->count++;
+		stage->total_ns += ns;
+		if(ns > stage->max_ns) stage->max_ns = ns;
+	}
 
-	static ssize_t rng_read (struct file *pfile, char __user *buff, size_t count, loff_t *ppos)
+	/**
+	 * pipeline_tick - Runs the pipeline for the timer expiries since the last call. Only the last state of the switches
+	 * is processed, the other expiries are missed.
+	 * @period: Cycles between the expiries.
+	 */
+	static void pipeline_tick(u64 expiries, u32 period)
 	{
+		struct pipeline_state *pl = &pipeline;
+		struct device_data *sw, *pwm;
+		struct pipeline_lut *lut;
+		unsigned long flags;
+		u64 t[PIPELINE_STAGES + 1];
+		u32 duty[8];
 		u32 val;
-		char str[11];
-		int len;
-		void __iomem *ks_rng_base = ((struct chardev_data_type*)(pfile->private_data))->base;
-		if(!ks_rng_base) return -ENODEV;
+		int ch;
 
-		// Return data only if there is enough place for them. No numbers are skipped this way.
-		if (count<2) return 0;
-
-		val = ioread16(ks_rng_base);
+		if(!READ_ONCE(pipeline_enable) || !expiries) return;
+		if(!spin_trylock_irqsave(&pl->lock,flags))
+		{
+			atomic64_inc(&pl->busy);
+			return;
+		}
+		pl->ticks++;
+		pl->missed += expiries - 1;
+		sw = slot_tryget(&slots[PERIPH_ID_SW]);
+		pwm = slot_tryget(&slots[PERIPH_ID_PWM]);
+		// After a swap the slot of the PWM may be bound to the generic driver, that has other registers.
+		if(!sw || !pwm || pwm->fops != &led_pwm_fops)
+		{
+			pl->unavailable++;
+			goto out;
+		}
 
-		if( copy_to_user(buff, (uint8_t*)&val,2)) return -EFAULT;
-		else return 2;
+		// Sample: the readers of the switches get the value from the cache.
+		t[0] = ktime_get_ns();
+		val = pl_read32(sw,0);
+		reg_cache_update(sw,0,val,false);
+		val &= PIPELINE_LUT_ROWS - 1;
+
+		// Map
+		t[1] = ktime_get_ns();
+		rcu_read_lock();
+		lut = rcu_dereference(pl->lut);
+		if(lut) memcpy(duty,lut->duty[val],sizeof(duty));
+		else for(ch=0;ch<8;ch++) duty[ch] = (val & (1 << ch)) ? pwm_max_duty : 0;
+		rcu_read_unlock();
+
+		// Actuate: only the changed channels are written. The interrupts are already disabled.
+		t[2] = ktime_get_ns();
+		spin_lock(&led_pwm_lock);
+		for(ch=0;ch<8;ch++)
+		{
+			if(pwm->shadow[ch] == duty[ch]) continue;
+			led_pwm_set_locked(pwm,ch,duty[ch]);
+			pl->writes++;
+		}
+		spin_unlock(&led_pwm_lock);
+		t[3] = ktime_get_ns();
+
+		for(ch=0;ch<PIPELINE_STAGES;ch++) pipeline_stage_add(&pl->stage[ch],t[ch+1] - t[ch]);
+		pipeline_stage_add(&pl->stage[PIPELINE_STAGES],t[3] - t[0]);
+		if(t[3] - t[0] > div_u64((u64)period * NSEC_PER_SEC,PL_CLK_HZ)) pl->overruns++;
+	out:
+		if(sw) slot_put(&slots[PERIPH_ID_SW]);
+		if(pwm) slot_put(&slots[PERIPH_ID_PWM]);
+		spin_unlock_irqrestore(&pl->lock,flags);
 	}
 
-	static ssize_t rng_write (struct file *pfile, const char __user *buff, size_t count, loff_t *ppos)
+	/**
+	 * pipeline_read - Returns the lookup table in use, empty with the default mapping.
+	 */
+	static ssize_t pipeline_read(struct file *pfile, char __user *buff, size_t count, loff_t *ppos)
 	{
+		struct pipeline_lut *lut;
+		ssize_t retval = 0;
 
-		u32 val = 0;
-		void __iomem *ks_rng_base = ((struct chardev_data_type*)(pfile->private_data))->base;
-		if(!ks_rng_base) return -ENODEV;
-
-		if(count==0) return 0;
-		copy_from_user((void*)&val,buff,count>2?2:count);
+		mutex_lock(&pipeline.lut_lock);
+		lut = rcu_dereference_protected(pipeline.lut,lockdep_is_held(&pipeline.lut_lock));
+		if(lut) retval = simple_read_from_buffer(buff,count,ppos,lut->duty,sizeof(lut->duty));
+		mutex_unlock(&pipeline.lut_lock);
+		return retval;
+	}
 
-		printk(KERN_DEBUG"New random number generator seed: %d.\n",val);
+	/**
+	 * pipeline_write - Replaces the lookup table. The whole table has to be written at once, the duty values are
+	 * limited to pwm_max_duty.
+	 */
+	static ssize_t pipeline_write(struct file *pfile, const char __user *buff, size_t count, loff_t *ppos)
+	{
+		struct pipeline_lut *lut, *old;
+		int i, ch;
 
-		iowrite32(val,ks_rng_base);
+		if(count != sizeof(lut->duty)) return -EINVAL;
+		lut = kmalloc(sizeof(*lut),GFP_KERNEL);
+		if(!lut) return -ENOMEM;
+		if(copy_from_user(lut->duty,buff,count))
+		{
+			kfree(lut);
+			return -EFAULT;
+		}
+		for(i=0;i<PIPELINE_LUT_ROWS;i++)
+			for(ch=0;ch<8;ch++) lut->duty[i][ch] = min(lut->duty[i][ch],pwm_max_duty);
+
+		mutex_lock(&pipeline.lut_lock);
+		old = rcu_dereference_protected(pipeline.lut,lockdep_is_held(&pipeline.lut_lock));
+		rcu_assign_pointer(pipeline.lut,lut);
+		mutex_unlock(&pipeline.lut_lock);
+		// The ticks in progress may still use the old table.
+		if(old) kfree_rcu(old,rcu);
 		return count;
 	}
 
-	static struct file_operations rng_fops =
-	{
-			.owner = THIS_MODULE,
-			.open = general_open,
-			.release = general_close,
-			.read = rng_read,
-			.write = rng_write
+	static const struct file_operations pipeline_fops = {
+		.owner = THIS_MODULE,
+		.read = pipeline_read,
+		.write = pipeline_write,
+		.llseek = no_llseek,
 	};
 
-/////////////////////// Platform driver functions /////////////////////////////
+	static struct miscdevice pipeline_miscdev = {
+		.minor = MISC_DYNAMIC_MINOR,
+		.name = "pl_pipeline",
+		.fops = &pipeline_fops,
+	};
+	static bool pipeline_registered;
 
-	static int rng_probe(struct platform_device *pdev)
+	static void pipeline_init(void)
 	{
-		int retval;
-
-		printk(KERN_DEBUG"Probing random number generator driver.\n");
-		retval = alloc_resources(pdev,"myrandom",1,&rng_fops);
-		if(retval) return retval;
-
-		printk(KERN_INFO"Random number driver loaded.\n");
-		return 0;
+		spin_lock_init(&pipeline.lock);
+		mutex_init(&pipeline.lut_lock);
+		if(misc_register(&pipeline_miscdev)) printk(KERN_ERR"Cannot register the pl_pipeline device.\n");
+		else pipeline_registered = true;
 	}
 
-
-	static int rng_remove(struct platform_device *pdev)
+	/**
+	 * pipeline_exit - Removes the upload interface and frees the table. Called after the timer is stopped.
+	 */
+	static void pipeline_exit(void)
 	{
-		return free_resources(pdev);
+		if(pipeline_registered) misc_deregister(&pipeline_miscdev);
+		pipeline_registered = false;
+		synchronize_rcu();
+		kfree(rcu_dereference_protected(pipeline.lut,1));
+		RCU_INIT_POINTER(pipeline.lut,NULL);
 	}
 
+/*******************************************************************************
+ * 						GENERIC PL DRIVER
+ *******************************************************************************/
+
+	/*
+	 * Peripherals described by their device tree node, without own driver code. A new peripheral needs only its
+	 * bitstream and overlay, e.g. overlays/generic_sw.dts:
+	 *	compatible = "thesis,generic-pl-1.0";
+	 *	thesis,periph-id	Peripheral ID of the IP, selects the slot of the device.
+	 *	thesis,dev-name		Name of the character devices, the name of the node by default.
+	 *	thesis,channels		Number of character devices (1..8), the minor number selects the channel.
+	 *	thesis,channel-stride	Address distance of the channels, required for more channels.
+	 *	thesis,reg-names	Registers of a channel, in the order of the device file.
+	 *	thesis,reg-offsets	Byte offset of the registers in the first channel.
+	 *	thesis,reg-widths	16 or 32 bits, 32 by default.
+	 *	thesis,reg-access	"ro": read only, cached for cache_max_age_us.
+	 *				"rw": written by the driver only, reads are served by the cache.
+	 *				"wo": write only, reads return 0.
+	 *				"in": input, refreshed by the sampler, its changes are reported by poll.
+	 *				"rc": read has side effect (e.g. FIFO), never cached.
+	 *	thesis,irq-reg		Interrupt status register, written back with the read value to clear the interrupt.
+	 *				The interrupts are reported by poll, the input registers are not sampled then.
+	 *
+	 * The device file is the array of the registers of the channel, as 32 bit values. A read or write at byte offset
+	 * 4*n accesses the registers from the n-th one, as many as fit into the buffer. A read from offset 0 acknowledges
+	 * the events of the file. The devices have no llseek, use pread and pwrite.
+	 */
 
-	static struct of_device_id rng_match_table[]={
-			{.compatible = "xlnx,my-axi-random-1.0"},{}
+	/// Maximum number of registers of a channel.
+	#define GENERIC_MAX_REGS 16
+
+	// Access flags of a register
+	#define GENERIC_RD	0x1
+	#define GENERIC_WR	0x2
+	#define GENERIC_NOCACHE	0x4
+	#define GENERIC_SAMPLED	0x8
+
+	// Register read methods, selected at probe time.
+	enum generic_read_op{
+		GENERIC_READ_NONE,
+		GENERIC_READ_CACHED,
+		GENERIC_READ32,
+		GENERIC_READ16,
 	};
 
-	static struct platform_driver rng_driver={
-			.driver={
-					.name = "random",
-					.owner = THIS_MODULE,
-					.of_match_table = rng_match_table
-			},
-			.probe = rng_probe,
-			.remove = rng_remove
+	struct generic_reg{
+		u16 offset;		// Byte offset in the first channel.
+		u8 access;		// GENERIC_* flags
+		u8 read_op;		// enum generic_read_op
+		u32 mask;		// Written bits, by the width of the register.
 	};
 
+	// Register map of a generic device, built from its device tree node at probe time.
+	struct generic_pl{
+		struct device_data *data;
+		int periph_id;
+		const char *name;
+		u32 channels;
+		u32 stride;
+		int nregs;
+		int irq_reg;		// Index of the interrupt status register, -1 if none.
+		u8 sampled;		// Input registers for the cache sampler.
+		struct generic_reg regs[GENERIC_MAX_REGS];
+	};
+	static struct generic_pl *generic_devs[PERIPH_ID_NUM];
+
+	static const struct{
+		const char *name;
+		u8 access;
+	} generic_access_modes[] = {
+		{"ro",GENERIC_RD},
+		{"rw",GENERIC_RD | GENERIC_WR},
+		{"wo",GENERIC_WR},
+		{"in",GENERIC_RD | GENERIC_SAMPLED},
+		{"rc",GENERIC_RD | GENERIC_NOCACHE},
+	};
 
+	/**
+	 * generic_parse - Builds the register map of the device from the properties of its node.
+	 */
+	static int generic_parse(struct device_node *np, struct generic_pl *gen)
+	{
+		int i, j, ch;
+		u32 val;
+		const char *str;
+		struct generic_reg *reg;
 
-/*******************************************************************************
- * 						AXI TIMER DRIVER
- *******************************************************************************/
+		if(of_property_read_u32(np,"thesis,periph-id",&val) || val == 0 || val >= PERIPH_ID_NUM)
+		{
+			printk(KERN_ERR"%s: invalid thesis,periph-id.\n",np->name);
+			return -EINVAL;
+		}
+		gen->periph_id = val;
+		if(of_property_read_string(np,"thesis,dev-name",&gen->name)) gen->name = np->name;
+		gen->channels = 1;
+		of_property_read_u32(np,"thesis,channels",&gen->channels);
+		of_property_read_u32(np,"thesis,channel-stride",&gen->stride);
+		if(gen->channels < 1 || gen->channels > 8 || (gen->channels > 1 && gen->stride == 0))
+		{
+			printk(KERN_ERR"%s: invalid channels.\n",np->name);
+			return -EINVAL;
+		}
 
+		gen->nregs = of_property_count_strings(np,"thesis,reg-names");
+		if(gen->nregs < 1 || gen->nregs > GENERIC_MAX_REGS)
+		{
+			printk(KERN_ERR"%s: 1..%d registers are supported.\n",np->name,GENERIC_MAX_REGS);
+			return -EINVAL;
+		}
 
-	///////////////////////// File operations ///////////////////////////////////
+		for(i=0;i<gen->nregs;i++)
+		{
+			reg = &gen->regs[i];
+			if(of_property_read_u32_index(np,"thesis,reg-offsets",i,&val) || val % 4 ||
+					val + (gen->channels-1) * gen->stride + 4 > IOREMAP_SIZE)
+			{
+				printk(KERN_ERR"%s: invalid offset of register %d.\n",np->name,i);
+				return -EINVAL;
+			}
+			reg->offset = val;
+
+			val = 32;
+			of_property_read_u32_index(np,"thesis,reg-widths",i,&val);
+			if(val != 16 && val != 32)
+			{
+				printk(KERN_ERR"%s: invalid width of register %d.\n",np->name,i);
+				return -EINVAL;
+			}
+			reg->mask = val == 16 ? 0xFFFF : 0xFFFFFFFF;
+
+			if(of_property_read_string_index(np,"thesis,reg-access",i,&str)) str = "rw";
+			for(j=0;j<ARRAY_SIZE(generic_access_modes);j++)
+				if(!strcmp(str,generic_access_modes[j].name)) break;
+			if(j == ARRAY_SIZE(generic_access_modes))
+			{
+				printk(KERN_ERR"%s: invalid access mode of register %d: %s.\n",np->name,i,str);
+				return -EINVAL;
+			}
+			reg->access = generic_access_modes[j].access;
+
+			if(!(reg->access & GENERIC_RD)) reg->read_op = GENERIC_READ_NONE;
+			else if(val == 16) reg->read_op = GENERIC_READ16;
+			else if(reg->access & GENERIC_NOCACHE) reg->read_op = GENERIC_READ32;
+			else reg->read_op = GENERIC_READ_CACHED;
+
+			if(reg->access & GENERIC_SAMPLED)
+				for(ch=0;ch<gen->channels;ch++)
+					if((reg->offset + ch*gen->stride)/4 < SNAPSHOT_REGS) gen->sampled |= 1 << (reg->offset + ch*gen->stride)/4;
+		}
 
-	/*
-	 * timer_read - Gives the interrupt period as ASCII string.
+		gen->irq_reg = -1;
+		if(!of_property_read_u32(np,"thesis,irq-reg",&val))
+		{
+			if(val >= gen->nregs)
+			{
+				printk(KERN_ERR"%s: invalid thesis,irq-reg.\n",np->name);
+				return -EINVAL;
+			}
+			gen->irq_reg = val;
+			// The interrupt handler is the only event source of the slot.
+			gen->sampled = 0;
+		}
+		return 0;
+	}
+
+	///////////////////////// File operations /////////////////////////////////////
+
+	/**
+	 * generic_read - Reads the registers of the channel from the one at the file position.
 	 */
-	static ssize_t timer_read (struct file *pfile, char __user *buff, size_t count, loff_t *ppos)
+	static ssize_t generic_read (struct file *pfile, char __user *buff, size_t count, loff_t *ppos)
 	{
-		u32 period;
-		char period_str[11];
-		int str_len;
-		void __iomem *ks_timer_base = ((struct chardev_data_type*)pfile->private_data)->base;
-		if(!ks_timer_base) return -ENODEV;
+		u32 val[GENERIC_MAX_REGS];
+		int i, first, n;
+		unsigned int base;
+		struct generic_pl *gen;
+		struct generic_reg *reg;
+		struct device_data *data;
+		struct periph_session *ss = pfile->private_data;
 
-		period = ioread32(ks_timer_base + 4);
-		str_len = uint2str(period,period_str,11);
+		if(*ppos % 4) return -EINVAL;
+		if(count < 4) return 0;
 
-		if(*ppos >= str_len) return 0;
-		if(*ppos +count > str_len) count = str_len-*ppos;
-		if(copy_to_user(buff,period_str+*ppos,count)) return -EFAULT;
-		*ppos += count;
+		data = slot_get(ss->slot);
+		if(!data) return -EAGAIN;
+		// After a swap to the own overlay of the peripheral, the slot is bound to its own driver.
+		gen = generic_devs[data->periph_id];
+		if(!gen || gen->data != data)
+		{
+			slot_put(ss->slot);
+			return -EAGAIN;
+		}
+		first = *ppos/4;
+		n = first < gen->nregs ? min_t(size_t,count/4,gen->nregs - first) : 0;
+		base = MINOR(pfile->f_inode->i_rdev) * gen->stride;
 
-		return count;
+		for(i=0;i<n;i++)
+		{
+			reg = &gen->regs[first+i];
+			switch(reg->read_op)
+			{
+			case GENERIC_READ_CACHED:
+				val[i] = pl_read32_cached(data,base + reg->offset);
+				break;
+			case GENERIC_READ32:
+				val[i] = pl_read32(data,base + reg->offset);
+				break;
+			case GENERIC_READ16:
+				val[i] = pl_read16(data,base + reg->offset);
+				break;
+			default:
+				val[i] = 0;
+				break;
+			}
+		}
+		if(first == 0) session_skip_events(ss);
+		slot_put(ss->slot);
+
+		ss->reads++;
+		if(n == 0) return 0;
+		if(copy_to_user(buff,val,n*4)) return -EFAULT;
+		*ppos += n*4;
+		return n*4;
 	}
 
 	/**
-	 * Resets the timer with the given value. If value is less then 100000, timer is stopped. (Frquency is 100Mhz).
+	 * generic_write - Writes the registers of the channel from the one at the file position. Nothing is written, if
+	 * one of the registers is not writable.
 	 */
-	static ssize_t timer_write (struct file *pfile, const char __user *buff, size_t count, loff_t *ppos)
+	static ssize_t generic_write (struct file *pfile, const char __user *buff, size_t count, loff_t *ppos)
 	{
-		u32 val;
-		char ks_str[11];
-		int ks_len;
-		void __iomem *ks_timer_base = ((struct chardev_data_type*)pfile->private_data)->base;
-		if(!ks_timer_base) return -ENODEV;
-
-		ks_len = count>10?10:count;
-		ks_str[ks_len] = 0;
-		if(copy_from_user(ks_str,buff,ks_len)) {return -EFAULT;}
+		u32 val[GENERIC_MAX_REGS];
+		int i, first, n;
+		unsigned int offset, base;
+		struct generic_pl *gen;
+		struct generic_reg *reg;
+		struct device_data *data;
+		struct periph_session *ss = pfile->private_data;
 
+		if(*ppos % 4) return -EINVAL;
+		if(count < 4) return 0;
+		if(copy_from_user(val,buff,min_t(size_t,count,sizeof(val)) & ~3)) return -EFAULT;
 
-		// Convert input to u32.
-		val = str2int(ks_str,ks_len);
+		data = slot_get(ss->slot);
+		if(!data) return -EAGAIN;
+		// After a swap to the own overlay of the peripheral, the slot is bound to its own driver.
+		gen = generic_devs[data->periph_id];
+		if(!gen || gen->data != data)
+		{
+			slot_put(ss->slot);
+			return -EAGAIN;
+		}
+		first = *ppos/4;
+		n = first < gen->nregs ? min_t(size_t,count/4,gen->nregs - first) : 0;
+		base = MINOR(pfile->f_inode->i_rdev) * gen->stride;
 
-		printk(KERN_DEBUG"Value converted: %d.\n",val);
-		if(val < 100000)
+		for(i=0;i<n;i++)
 		{
-			//Stop timer
-			iowrite32(0x172,ks_timer_base);
-			printk(KERN_DEBUG"AXI timer is stopped, because period %d is too small.(It should be greater or equal than 100000.)\n",val);
+			if(!(gen->regs[first+i].access & GENERIC_WR))
+			{
+				slot_put(ss->slot);
+				return -EPERM;
+			}
 		}
-		else
+		for(i=0;i<n;i++)
 		{
-			// Set reset value ad reset the timer.
-			iowrite32(val,ks_timer_base + 4);	// Set reset value
-			iowrite32(0x172,ks_timer_base);		// Reset timer
-			iowrite32(0x1D2,ks_timer_base);		// Start timer
-			printk(KERN_DEBUG"AXI Timer is reseted with period: %d.\n",val);
+			reg = &gen->regs[first+i];
+			offset = base + reg->offset;
+			pl_write32(data,offset,val[i] & reg->mask);
+			if(offset/4 < SNAPSHOT_REGS) data->shadow[offset/4] = val[i] & reg->mask;
+			if(reg->read_op == GENERIC_READ_CACHED) reg_cache_update(data,offset,val[i] & reg->mask,true);
 		}
-		return count;
-	}
+		slot_put(ss->slot);
 
+		ss->writes++;
+		if(n == 0) return -ENOSPC;
+		*ppos += n*4;
+		return n*4;
+	}
 
-	static struct file_operations timer_fops=
+	static struct file_operations generic_fops =
 	{
 			.owner = THIS_MODULE,
 			.open = general_open,
 			.release = general_close,
-			.read = timer_read,
-			.write = timer_write
+			.read = generic_read,
+			.write = generic_write,
+			.poll = general_poll
 	};
 
-	////////////////////////////// interrupt handler /////////////////////////////
-	static int irq_num;
-	static struct workqueue_struct *w_queue = NULL;
-	void timer_irq_worker(struct work_struct*);
-	DECLARE_WORK(task,timer_irq_worker);
-	void __iomem *id_address;
-
-	// Interrupt handler - TOP HALF
-	irqreturn_t timer_irq_handler(int irq, void *dev_id)
+	/**
+	 * generic_irq_handler - Clears the interrupt by writing back the status register, and reports it to the sessions.
+	 */
+	static irqreturn_t generic_irq_handler(int irq, void *dev_id)
 	{
-		// Clearing interrupt flag.
-		u32 reg_val;
-		reg_val = ioread32(id_address);
-		iowrite32(reg_val,id_address);
-		queue_work(w_queue,&task);
+		struct generic_pl *gen = dev_id;
+		unsigned int offset = gen->regs[gen->irq_reg].offset;
+		u32 val;
+
+		val = pl_read32(gen->data,offset);
+		pl_write32(gen->data,offset,val);
+		slot_event(&slots[gen->periph_id],val);
 		return IRQ_HANDLED;
 	}
 
+/////////////////////// Platform driver functions /////////////////////////////
 
-	// Interrupt handler - BOTTOM HALF
-	void timer_irq_worker(struct work_struct* ws)
+	static int generic_probe(struct platform_device *pdev)
 	{
-		printk(KERN_DEBUG"AXI TIMER interrupt occurred.\n");
+		int retval;
+		int i, ch;
+		unsigned int offset;
+		const u32 *regs;
+		struct generic_pl *gen;
+		struct device_data *data;
+
+		gen = kzalloc(sizeof(*gen),GFP_KERNEL);
+		if(!gen) return -ENOMEM;
+		retval = generic_parse(pdev->dev.of_node,gen);
+		if(retval) goto err0;
+
+		// Fails, if the peripheral is bound to its own driver.
+		retval = alloc_resources(pdev,gen->periph_id,gen->name,gen->channels,&generic_fops);
+		if(retval) goto err0;
+		data = platform_get_drvdata(pdev);
+		gen->data = data;
+		generic_devs[gen->periph_id] = gen;
+
+		if(gen->irq_reg >= 0 && !simulate && request_irq(data->irq_num,generic_irq_handler,0,gen->name,gen))
+		{
+			printk(KERN_ERR"Cannot request the interrupt %d of %s.\n",data->irq_num,gen->name);
+			retval = -EBUSY;
+			goto err1;
+		}
+		data->cache.sample_mask = gen->sampled;
+		if(cache_sample_ms && gen->sampled) schedule_delayed_work(&data->cache.sampler,0);
+
+		// Restore the registers owned by the driver.
+		regs = restore_snapshot(pdev);
+		for(i=0;regs && i<gen->nregs;i++)
+		{
+			if(gen->regs[i].access != (GENERIC_RD | GENERIC_WR)) continue;
+			for(ch=0;ch<gen->channels;ch++)
+			{
+				offset = gen->regs[i].offset + ch*gen->stride;
+				if(offset/4 >= SNAPSHOT_REGS) continue;
+				pl_write32(data,offset,regs[offset/4]);
+				reg_cache_update(data,offset,regs[offset/4],true);
+			}
+		}
+
+		slot_attach(pdev);
+		dev_dbg(&pdev->dev,"Generic PL driver loaded for %s, %d registers.\n",gen->name,gen->nregs);
+		return 0;
+
+		err1:
+			generic_devs[gen->periph_id] = NULL;
+			free_resources(pdev);
+		err0:
+			kfree(gen);
+		return retval;
 	}
-/////////////////////////////// Platform driver functions ////////////////////////
 
-	static int timer_probe(struct platform_device *pdev)
+	static int generic_remove(struct platform_device *pdev)
 	{
-		// Locals
 		int retval;
-		struct device_data *data;
+		struct generic_pl *gen;
+		struct device_data *data = platform_get_drvdata(pdev);
 
-		printk(KERN_DEBUG"Probing axi_timer driver.\n");
-		retval = alloc_resources(pdev,"mytimer",1,&timer_fops);
-		if(retval) return retval;
+		if(!data) return 0;
+		gen = generic_devs[data->periph_id];
+		if(gen->irq_reg >= 0 && !simulate) free_irq(data->irq_num,gen);
+		retval = free_resources(pdev);
+		generic_devs[gen->periph_id] = NULL;
+		kfree(gen);
+		return retval;
+	}
 
-		data = (struct device_data*)platform_get_drvdata(pdev);
-		id_address = data->base;
+	static struct of_device_id generic_match_table[]={
+			{.compatible = "thesis,generic-pl-1.0"},{}
+	};
+
+	static struct platform_driver generic_driver={
+			.driver={
+					.name = "generic_pl",
+					.owner = THIS_MODULE,
+					.of_match_table = generic_match_table,
+					.probe_type = PROBE_PREFER_ASYNCHRONOUS
+			},
+			.probe = generic_probe,
+			.remove = generic_remove
+	};
+/******************************************************** Misc functions ******************************************************************/
+u32 str2int(const char*str,int len)
+{
+	int i;
+	u32 val;
+
+	for(val=0, i=0; str[i] >= '0' && str[i] <= '9' && i<len; i++)
+	{
+		val *=10;
+		val += str[i]-'0';
+	}
+	return val;
+}
+int uint2str(u32 num, char*str,size_t len)
+{
+	int l;
+	char rev[15];
+	int i;
+	size_t digit_num;
+
+	if(num == 0)
+	{
+		rev[0] = '0';
+		l = 1;
+	}
+	else
+	for(l=0;num>0;l++)
+	{
+		rev[l] = '0' + num %10;
+		num /= 10;
+	}
+
+	if(len-1 > l)
+		digit_num = l;
+	else
+		digit_num = len-1;
+
+
+	for(i=0;i<digit_num;i++)
+	{
+		str[digit_num-1-i] = rev[i];
+	}
+	str[digit_num] = 0;
+
+	return digit_num+1;
+}
+/***************************************************** Misc functions END ******************************************************************/
+
+/***************************************************** Statistics ******************************************************************/
+
+static struct dentry *dd_debugfs;
+
+static const char *periph_names[PERIPH_ID_NUM] = {
+	[PERIPH_ID_PWM] = "led_pwm",
+	[PERIPH_ID_RNG] = "myrandom",
+	[PERIPH_ID_SW] = "sw",
+	[PERIPH_ID_TIMER] = "mytimer",
+	[5] = "pl5",
+	[6] = "pl6",
+	[7] = "pl7",
+};
+
+/**
+ * swap_stats_show - Prints the swap latency and stall statistics of the peripheral slots.
+ */
+static int swap_stats_show(struct seq_file *s, void *unused)
+{
+	int i;
+	struct periph_slot *slot;
+
+	seq_printf(s,"%-10s %8s %14s %14s %14s %14s %8s %10s\n","device","swaps","offline_avg_us","offline_max_us",
+			"drain_avg_us","drain_max_us","timeouts","eagain");
+	for(i=1;i<PERIPH_ID_NUM;i++)
+	{
+		slot = &slots[i];
+		seq_printf(s,"%-10s %8llu %14llu %14llu %14llu %14llu %8llu %10lld\n",periph_names[i],slot->swaps,
+				slot->swaps ? div64_u64(slot->offline_ns_total,slot->swaps*NSEC_PER_USEC) : 0,
+				div_u64(slot->offline_ns_max,NSEC_PER_USEC),
+				slot->swaps ? div64_u64(slot->drain_ns_total,slot->swaps*NSEC_PER_USEC) : 0,
+				div_u64(slot->drain_ns_max,NSEC_PER_USEC),
+				slot->drain_timeouts,(long long)atomic64_read(&slot->eagain));
+	}
+	return 0;
+}
+
+static int swap_stats_open(struct inode *inode, struct file *pfile)
+{
+	return single_open(pfile,swap_stats_show,NULL);
+}
+
+/**
+ * probe_stats_show - Prints the module initialization time and the bring-up times of the last probes.
+ */
+static int probe_stats_show(struct seq_file *s, void *unused)
+{
+	int i;
+	struct periph_slot *slot;
+
+	seq_printf(s,"init_us: %llu\n",div_u64(module_init_ns,NSEC_PER_USEC));
+	seq_printf(s,"%-10s %8s %17s %18s %10s\n","device","probes","node_from_load_us","node_from_probe_us","probe_us");
+	for(i=1;i<PERIPH_ID_NUM;i++)
+	{
+		slot = &slots[i];
+		seq_printf(s,"%-10s %8llu %17llu %18llu %10llu\n",periph_names[i],slot->probes,
+				div_u64(slot->node_ready_ns,NSEC_PER_USEC),div_u64(slot->node_latency_ns,NSEC_PER_USEC),
+				div_u64(slot->probe_ns,NSEC_PER_USEC));
+	}
+	return 0;
+}
+
+static int probe_stats_open(struct inode *inode, struct file *pfile)
+{
+	return single_open(pfile,probe_stats_show,NULL);
+}
+
+static const struct file_operations probe_stats_fops = {
+	.owner = THIS_MODULE,
+	.open = probe_stats_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static const struct file_operations swap_stats_fops = {
+	.owner = THIS_MODULE,
+	.open = swap_stats_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+/**
+ * fop_stats_show - Prints the number and mean duration of the read and write calls of the devices.
+ */
+static int fop_stats_show(struct seq_file *s, void *unused)
+{
+	int i,j;
+	u64 calls, ns, ns_per_op;
+	static const char *op_names[2] = {"read","write"};
 
-		// Registering interrupt handler
-		if(request_irq(data->irq_num,timer_irq_handler,0,"AXI_TIMER",NULL))
+	seq_printf(s,"%-10s %6s %10s %10s %12s %12s\n","device","op","calls","ns_per_op","ops_per_sec","bytes");
+	for(i=1;i<PERIPH_ID_NUM;i++)
+	{
+		for(j=0;j<2;j++)
 		{
-			printk(KERN_ERR"The interrupt %d is already taken.\n",irq_num);
-			retval = -EBUSY;
-			goto err0;
+			calls = atomic64_read(&slots[i].fop_stat[j].calls);
+			ns = atomic64_read(&slots[i].fop_stat[j].ns);
+			ns_per_op = calls ? div64_u64(ns,calls) : 0;
+			seq_printf(s,"%-10s %6s %10llu %10llu %12llu %12lld\n",periph_names[i],op_names[j],calls,ns_per_op,
+					ns_per_op ? div64_u64(NSEC_PER_SEC,ns_per_op) : 0,(long long)atomic64_read(&slots[i].fop_stat[j].bytes));
 		}
+	}
+	return 0;
+}
+
+static int fop_stats_open(struct inode *inode, struct file *pfile)
+{
+	return single_open(pfile,fop_stats_show,NULL);
+}
+
+/**
+ * fop_stats_write - Any write clears the file operation statistics.
+ */
+static ssize_t fop_stats_write(struct file *pfile, const char __user *buff, size_t count, loff_t *ppos)
+{
+	int i,j;
 
-		// Creating workqueue.
-		w_queue = create_workqueue("AXI_TIMER_workqueue");
-		if(!w_queue)
+	for(i=0;i<PERIPH_ID_NUM;i++)
+	{
+		for(j=0;j<2;j++)
 		{
-			printk(KERN_ERR"Cannot create workqueue.\n");
-			retval = -ENOMEM;
-			goto err1;
+			atomic64_set(&slots[i].fop_stat[j].calls,0);
+			atomic64_set(&slots[i].fop_stat[j].ns,0);
+			atomic64_set(&slots[i].fop_stat[j].bytes,0);
 		}
+	}
+	return count;
+}
 
-		printk(KERN_INFO"AXI timer driver loaded.\n");
-		return 0;
+static const struct file_operations fop_stats_fops = {
+	.owner = THIS_MODULE,
+	.open = fop_stats_open,
+	.read = seq_read,
+	.write = fop_stats_write,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+/**
+ * cache_stats_show - Prints the number of register reads served by the cache and by the devices.
+ */
+static int cache_stats_show(struct seq_file *s, void *unused)
+{
+	int i;
+	u64 hits, mmio;
 
-		err1:
-			free_irq(data->irq_num,NULL);
-		err0:
-			free_resources(pdev);
-		return retval;
+	seq_printf(s,"%-10s %10s %12s %12s %8s\n","device","max_age_us","cache_hits","mmio_reads","hit_pct");
+	for(i=1;i<PERIPH_ID_NUM;i++)
+	{
+		hits = atomic64_read(&slots[i].cache_hits);
+		mmio = atomic64_read(&slots[i].mmio_reads);
+		seq_printf(s,"%-10s %10u %12llu %12llu %8llu\n",periph_names[i],READ_ONCE(cache_max_age_us[i]),hits,mmio,
+				hits+mmio ? div64_u64(hits*100,hits+mmio) : 0);
 	}
+	return 0;
+}
 
-	static int timer_remove(struct platform_device *pdev)
+static int cache_stats_open(struct inode *inode, struct file *pfile)
+{
+	return single_open(pfile,cache_stats_show,NULL);
+}
+
+/**
+ * cache_stats_write - Any write clears the cache statistics.
+ */
+static ssize_t cache_stats_write(struct file *pfile, const char __user *buff, size_t count, loff_t *ppos)
+{
+	int i;
+
+	for(i=0;i<PERIPH_ID_NUM;i++)
 	{
-		struct device_data *data = (struct device_data*)platform_get_drvdata(pdev);
-		if(!data) return 0;
+		atomic64_set(&slots[i].cache_hits,0);
+		atomic64_set(&slots[i].mmio_reads,0);
+	}
+	return count;
+}
 
-		destroy_workqueue(w_queue);
-		free_irq(data->irq_num,NULL);
-		return free_resources(pdev);
+static const struct file_operations cache_stats_fops = {
+	.owner = THIS_MODULE,
+	.open = cache_stats_open,
+	.read = seq_read,
+	.write = cache_stats_write,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+/**
+ * sessions_show - Lists the open files of the peripherals.
+ */
+static int sessions_show(struct seq_file *s, void *unused)
+{
+	int i;
+	struct periph_session *ss;
+
+	seq_printf(s,"%-10s %8s %10s %10s %10s %10s %10s\n","device","pid","reads","writes","events","lost","subscribed");
+	mutex_lock(&sessions_lock);
+	for(i=1;i<PERIPH_ID_NUM;i++)
+	{
+		list_for_each_entry(ss,&slots[i].sessions,node)
+			seq_printf(s,"%-10s %8d %10llu %10llu %10llu %10llu %10d\n",periph_names[i],ss->pid,ss->reads,ss->writes,
+					ss->events,ss->lost,ss->subscribed);
 	}
+	mutex_unlock(&sessions_lock);
+	return 0;
+}
 
-	static struct of_device_id timer_match_table[]={
-			{.compatible =  "xlnx,xps-timer-1.00.a"},{}
-	};
+static int sessions_open(struct inode *inode, struct file *pfile)
+{
+	return single_open(pfile,sessions_show,NULL);
+}
 
+static const struct file_operations sessions_fops = {
+	.owner = THIS_MODULE,
+	.open = sessions_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
 
-	static struct platform_driver timer_driver={
-			.driver={
-					.name = "timer",
-					.owner = THIS_MODULE,
-					.of_match_table = timer_match_table
-			},
-			.probe = timer_probe,
-			.remove = timer_remove
-	};
-/*******************************************************************************
- * 						LED_PWM DRIVER
- *******************************************************************************/
+/**
+ * timer_stats_show - Prints the mode of the timer, its expiry rate and the interrupt and polling counts.
+ */
+static int timer_stats_show(struct seq_file *s, void *unused)
+{
+	struct timer_adaptive *ta = &timer_adapt;
+	unsigned long flags;
+
+	spin_lock_irqsave(&ta->lock,flags);
+	seq_printf(s,"mode: %s\n",ta->polling ? "poll" : "irq");
+	seq_printf(s,"rate: %llu\n",ta->rate);
+	seq_printf(s,"period_mult: %u\n",ta->mult);
+	seq_printf(s,"expiries: %llu\n",ta->expiries);
+	seq_printf(s,"irqs: %llu\n",ta->irqs);
+	seq_printf(s,"polls: %llu\n",ta->polls);
+	seq_printf(s,"to_poll: %llu\n",ta->to_poll);
+	seq_printf(s,"to_irq: %llu\n",ta->to_irq);
+	seq_printf(s,"coalesced: %llu\n",ta->coalesced);
+	spin_unlock_irqrestore(&ta->lock,flags);
+	return 0;
+}
 
+static int timer_stats_open(struct inode *inode, struct file *pfile)
+{
+	return single_open(pfile,timer_stats_show,NULL);
+}
 
-///////////////// LED PWM File operations module //////////////////////////////
+/**
+ * timer_stats_write - Any write clears the timer statistics.
+ */
+static ssize_t timer_stats_write(struct file *pfile, const char __user *buff, size_t count, loff_t *ppos)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&timer_adapt.lock,flags);
+	timer_adapt.expiries = 0;
+	timer_adapt.irqs = 0;
+	timer_adapt.polls = 0;
+	timer_adapt.to_poll = 0;
+	timer_adapt.to_irq = 0;
+	timer_adapt.coalesced = 0;
+	spin_unlock_irqrestore(&timer_adapt.lock,flags);
+	return count;
+}
 
-		/**
-		 * led_pwm_read - Returns the brightness of the leds as an ASCII string.
-		 */
-		static ssize_t led_pwm_read (struct file *pfile, char __user *buff, size_t count, loff_t *ppos)
-		{
-			//Locals
-			int minor;
-			u32 pwm_val;
-			int len = 0;
-			char str[11];
-			void __iomem *ks_led_pwm_base = ((struct chardev_data_type*)pfile->private_data)->base;
-			if(!ks_led_pwm_base) return -ENODEV;
+static const struct file_operations timer_stats_fops = {
+	.owner = THIS_MODULE,
+	.open = timer_stats_open,
+	.read = seq_read,
+	.write = timer_stats_write,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
 
-			// Getting the minor number, it tells, which led should be modified.
-			minor = MINOR(pfile->f_inode->i_rdev);
-			pwm_val = ioread32(ks_led_pwm_base+minor*4);
+/**
+ * pipeline_stats_show - Prints the tick counts of the control pipeline, and the duration of its stages.
+ */
+static int pipeline_stats_show(struct seq_file *s, void *unused)
+{
+	static const char *stage_names[PIPELINE_STAGES + 1] = {"sample","map","actuate","tick"};
+	struct pipeline_state *pl = &pipeline;
+	struct pipeline_stage stage[PIPELINE_STAGES + 1];
+	u64 ticks, missed, overruns, unavailable, writes;
+	unsigned long flags;
+	int i;
 
-			len = uint2str(pwm_val,str,11);
+	spin_lock_irqsave(&pl->lock,flags);
+	memcpy(stage,pl->stage,sizeof(stage));
+	ticks = pl->ticks;
+	missed = pl->missed;
+	overruns = pl->overruns;
+	unavailable = pl->unavailable;
+	writes = pl->writes;
+	spin_unlock_irqrestore(&pl->lock,flags);
+
+	seq_printf(s,"enabled: %d\n",pipeline_enable);
+	seq_printf(s,"lut: %s\n",rcu_access_pointer(pl->lut) ? "uploaded" : "default");
+	seq_printf(s,"ticks: %llu\n",ticks);
+	seq_printf(s,"missed: %llu\n",missed);
+	seq_printf(s,"busy: %llu\n",(u64)atomic64_read(&pl->busy));
+	seq_printf(s,"overruns: %llu\n",overruns);
+	seq_printf(s,"unavailable: %llu\n",unavailable);
+	seq_printf(s,"pwm_writes: %llu\n",writes);
+	seq_printf(s,"%-10s %10s %10s %10s\n","stage","count","avg_ns","max_ns");
+	for(i=0;i<=PIPELINE_STAGES;i++)
+	{
+		seq_printf(s,"%-10s %10llu %10llu %10llu\n",stage_names[i],stage[i].count,
+				stage[i].count ? div64_u64(stage[i].total_ns,stage[i].count) : 0,stage[i].max_ns);
+	}
+	return 0;
+}
 
-			if(*ppos >= len) return 0;
-			if(*ppos+count > len) count = len - *ppos;
-			if(copy_to_user(buff,str+*ppos,count)) return -EFAULT;
-			*ppos+=count;
-			return count;
-		}
+static int pipeline_stats_open(struct inode *inode, struct file *pfile)
+{
+	return single_open(pfile,pipeline_stats_show,NULL);
+}
 
-		/**
-		 * led_pwm_write - Sets the brightness of the leds.
-		 */
-		static ssize_t led_pwm_write (struct file *pfile, const char __user *buff, size_t count, loff_t *ppos)
-		{
-			int minor;
+/**
+ * pipeline_stats_write - Any write clears the pipeline statistics.
+ */
+static ssize_t pipeline_stats_write(struct file *pfile, const char __user *buff, size_t count, loff_t *ppos)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&pipeline.lock,flags);
+	memset(pipeline.stage,0,sizeof(pipeline.stage));
+	pipeline.ticks = 0;
+	pipeline.missed = 0;
+	pipeline.overruns = 0;
+	pipeline.unavailable = 0;
+	pipeline.writes = 0;
+	atomic64_set(&pipeline.busy,0);
+	spin_unlock_irqrestore(&pipeline.lock,flags);
+	return count;
+}
 
-			char str[11];
-			int len;
-			u32 val = 0;
-			void __iomem *ks_led_pwm_base = ((struct chardev_data_type*)pfile->private_data)->base;
-			if(!ks_led_pwm_base) return -ENODEV;
+static const struct file_operations pipeline_stats_fops = {
+	.owner = THIS_MODULE,
+	.open = pipeline_stats_open,
+	.read = seq_read,
+	.write = pipeline_stats_write,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
 
-			// Getting minor number
-			minor = MINOR(pfile->f_inode->i_rdev);
+// Trace copied at the open of the mmio_trace file.
+struct mmio_trace_dump{
+	size_t len;
+	struct mmio_trace_rec rec[];
+};
 
-			len = count>10?10:count;
-			if(copy_from_user(str,buff,len)) return -EFAULT;
-			str[len] = 0;
+static int mmio_trace_cmp(const void *a, const void *b)
+{
+	const struct mmio_trace_rec *ra = a, *rb = b;
 
-			val = str2int(str,len);
+	if(ra->ns < rb->ns) return -1;
+	return ra->ns > rb->ns;
+}
 
-			// write the value to the register
-			iowrite32(val,ks_led_pwm_base + minor*4);
+// Serializes the switching of mmio_trace and the access to the saved trace.
+static DEFINE_MUTEX(mmio_trace_lock);
+// Trace merged when the recording was switched off, NULL if it was cleared.
+static struct mmio_trace_dump *mmio_trace_saved;
 
-			return count;
-		}
+/**
+ * mmio_trace_merge - Merges the trace rings of the CPUs in time order. Must be called with mmio_trace_lock held.
+ *
+ * The rings are not stopped, the trace is complete only after mmio_trace is switched off.
+ */
+static struct mmio_trace_dump *mmio_trace_merge(void)
+{
+	int cpu;
+	unsigned int head, n, i;
+	size_t len = 0;
+	struct mmio_trace_ring *ring;
+	struct mmio_trace_dump *dump;
+
+	dump = vmalloc(sizeof(*dump) + num_possible_cpus() * sizeof(ring->rec));
+	if(!dump) return NULL;
+	for_each_possible_cpu(cpu)
+	{
+		ring = per_cpu(mmio_rings,cpu);
+		if(!ring) continue;
+		head = READ_ONCE(ring->head);
+		n = min_t(unsigned int,head,MMIO_TRACE_LEN);
+		for(i=head-n;i!=head;i++) dump->rec[len++] = ring->rec[i % MMIO_TRACE_LEN];
+	}
+	dump->len = len;
+	sort(dump->rec,len,sizeof(dump->rec[0]),mmio_trace_cmp,NULL);
+	return dump;
+}
 
-		static struct file_operations led_pwm_fops=
-		{
-				.owner = THIS_MODULE,
-				.read = led_pwm_read,
-				.write = led_pwm_write,
-				.open = general_open,
-				.release = general_close
-		};
+/**
+ * mmio_trace_copy - Copies the trace into a buffer of its size, or into an empty trace if it is NULL.
+ */
+static struct mmio_trace_dump *mmio_trace_copy(const struct mmio_trace_dump *src)
+{
+	size_t len = src ? src->len : 0;
+	struct mmio_trace_dump *dump;
+
+	dump = vmalloc(sizeof(*dump) + len * sizeof(dump->rec[0]));
+	if(!dump) return NULL;
+	dump->len = len;
+	if(len) memcpy(dump->rec,src->rec,len * sizeof(dump->rec[0]));
+	return dump;
+}
 
-///////////////////////////////// LED_PWM Platform driver functions  /////////////////////////////////////////////
+/**
+ * mmio_trace_open - Takes the trace recorded so far, or the saved one if the recording is switched off.
+ */
+static int mmio_trace_open(struct inode *inode, struct file *pfile)
+{
+	struct mmio_trace_dump *dump;
+
+	if(!(pfile->f_mode & FMODE_READ)) return 0;
+	mutex_lock(&mmio_trace_lock);
+	dump = mmio_trace ? mmio_trace_merge() : mmio_trace_copy(mmio_trace_saved);
+	mutex_unlock(&mmio_trace_lock);
+	if(!dump) return -ENOMEM;
+	pfile->private_data = dump;
+	return 0;
+}
 
-static int led_pwm_probe(struct platform_device *pdev)
+static ssize_t mmio_trace_read(struct file *pfile, char __user *buff, size_t count, loff_t *ppos)
 {
-	// Locals
-	int retval;
+	struct mmio_trace_dump *dump = pfile->private_data;
 
-	printk(KERN_DEBUG"Probing led_pwm driver.\n");
-	retval = alloc_resources(pdev,"led_pwm",8,&led_pwm_fops);
-	if(retval) return retval;
+	return simple_read_from_buffer(buff,count,ppos,dump->rec,dump->len * sizeof(dump->rec[0]));
+}
 
+/**
+ * mmio_trace_write - Any write clears the trace.
+ */
+static ssize_t mmio_trace_write(struct file *pfile, const char __user *buff, size_t count, loff_t *ppos)
+{
+	int cpu;
+	struct mmio_trace_ring *ring;
 
-	printk(KERN_INFO"PWM led driver loaded.\n");
-	return 0;
+	mutex_lock(&mmio_trace_lock);
+	for_each_possible_cpu(cpu)
+	{
+		ring = per_cpu(mmio_rings,cpu);
+		if(ring) WRITE_ONCE(ring->head,0);
+	}
+	vfree(mmio_trace_saved);
+	mmio_trace_saved = NULL;
+	mutex_unlock(&mmio_trace_lock);
+	return count;
 }
 
-int led_pwm_remove(struct platform_device *pdev)
+static int mmio_trace_release(struct inode *inode, struct file *pfile)
 {
-	return free_resources(pdev);
+	vfree(pfile->private_data);
+	return 0;
 }
 
-static struct of_device_id led_pwm_match_table[]={
-		{.compatible = "xlnx,my-axi-pwm-1.0"},{}
+static const struct file_operations mmio_trace_fops = {
+	.owner = THIS_MODULE,
+	.open = mmio_trace_open,
+	.read = mmio_trace_read,
+	.write = mmio_trace_write,
+	.llseek = default_llseek,
+	.release = mmio_trace_release,
 };
 
-static struct platform_driver led_pwm_driver={
-		.driver={
-				.name = "led_pwm",
-				.owner = THIS_MODULE,
-				.of_match_table = led_pwm_match_table
-		},
-		.probe = led_pwm_probe,
-		.remove = led_pwm_remove
-};
-/******************************************************** Misc functions ******************************************************************/
-u32 str2int(const char*str,int len)
+/**
+ * mmio_trace_free - Frees the trace rings of the CPUs. Must be called with mmio_trace_lock held, when no register access
+ * uses them.
+ */
+static void mmio_trace_free(void)
 {
-	int i;
-	u32 val;
+	int cpu;
 
-	for(val=0, i=0; str[i] >= '0' && str[i] <= '9' && i<len; i++)
+	for_each_possible_cpu(cpu)
 	{
-		val *=10;
-		val += str[i]-'0';
+		vfree(per_cpu(mmio_rings,cpu));
+		per_cpu(mmio_rings,cpu) = NULL;
 	}
-	return val;
 }
-int uint2str(u32 num, char*str,size_t len)
-{
-	int l;
-	char rev[15];
-	int i;
-	size_t digit_num;
 
-	if(num == 0)
+/**
+ * mmio_trace_set - Switches the recording of the register accesses. The trace rings of the CPUs exist only while
+ * recording. When the recording is switched off, the trace is saved until it is cleared or the recording is restarted.
+ */
+static int mmio_trace_set(const char *val, const struct kernel_param *kp)
+{
+	int cpu;
+	bool on;
+	int ret = kstrtobool(val,&on);
+	struct mmio_trace_dump *dump;
+
+	if(ret) return ret;
+	mutex_lock(&mmio_trace_lock);
+	if(on && !mmio_trace)
 	{
-		rev[0] = '0';
-		l = 1;
+		for_each_possible_cpu(cpu)
+		{
+			per_cpu(mmio_rings,cpu) = vzalloc(sizeof(struct mmio_trace_ring));
+			if(!per_cpu(mmio_rings,cpu))
+			{
+				printk(KERN_ERR"Cannot allocate the MMIO trace of CPU %d.\n",cpu);
+				mmio_trace_free();
+				ret = -ENOMEM;
+				goto out;
+			}
+		}
+		vfree(mmio_trace_saved);
+		mmio_trace_saved = NULL;
+		WRITE_ONCE(mmio_trace,true);
 	}
-	else
-	for(l=0;num>0;l++)
+	else if(!on && mmio_trace)
 	{
-		rev[l] = '0' + num %10;
-		num /= 10;
+		WRITE_ONCE(mmio_trace,false);
+		// The accesses in progress add their records with the interrupts disabled.
+		synchronize_sched();
+		dump = mmio_trace_merge();
+		mmio_trace_saved = dump ? mmio_trace_copy(dump) : NULL;
+		vfree(dump);
+		if(!mmio_trace_saved) printk(KERN_ERR"No memory for the MMIO trace, it is lost.\n");
+		mmio_trace_free();
 	}
+out:
+	mutex_unlock(&mmio_trace_lock);
+	return ret;
+}
 
-	if(len-1 > l)
-		digit_num = l;
-	else
-		digit_num = len-1;
+static const struct kernel_param_ops mmio_trace_ops = {
+	.set = mmio_trace_set,
+	.get = param_get_bool,
+};
+module_param_cb(mmio_trace,&mmio_trace_ops,&mmio_trace,0644);
+MODULE_PARM_DESC(mmio_trace,"Record every register access into the mmio_trace debugfs file. The trace is kept after switching it off, until it is cleared or recording is switched on again.");
+/*************************************************** Statistics END ******************************************************************/
 
+/* MODULE FUNCTIONS */
 
-	for(i=0;i<digit_num;i++)
+/// Platform drivers implemented in this file, in registration order.
+static struct platform_driver *platform_drivers[] = {
+	&led_pwm_driver,
+	&sw_driver,
+	&rng_driver,
+	&timer_driver,
+	&generic_driver,
+};
+
+// Devices created in simulation mode, indexed by peripheral ID.
+static struct platform_device *sim_pdevs[PERIPH_ID_NUM];
+
+/**
+ * create_sim_devices - Creates the simulated devices selected by sim_devices. They are bound to the drivers by name.
+ */
+static void create_sim_devices(void)
+{
+	int i;
+	static const char *pdev_names[PERIPH_ID_NUM] = {
+		[PERIPH_ID_PWM] = "led_pwm",
+		[PERIPH_ID_RNG] = "random",
+		[PERIPH_ID_SW] = "sw",
+		[PERIPH_ID_TIMER] = "timer",
+	};
+
+	for(i=1;i<PERIPH_ID_NUM;i++)
 	{
-		str[digit_num-1-i] = rev[i];
+		// The generic peripherals are described by the device tree only.
+		if(!(sim_devices & (1 << i)) || !pdev_names[i]) continue;
+		sim_pdevs[i] = platform_device_register_simple(pdev_names[i],-1,NULL,0);
+		if(IS_ERR(sim_pdevs[i]))
+		{
+			printk(KERN_ERR"Cannot create simulated %s device.\n",pdev_names[i]);
+			sim_pdevs[i] = NULL;
+		}
 	}
-	str[digit_num] = 0;
-
-	return digit_num+1;
 }
-/***************************************************** Misc functions END ******************************************************************/
-
-/* MODULE FUNCTIONS */
 
 /**
  * device_drivers_init - Registers all the platform drivers implemented in this file.
+ *
+ * The drivers prefer asynchronous probing, so the devices already present in the device tree are probed in parallel,
+ * and the registration does not wait for them.
  */
 static int __init device_drivers_init(void)
 {
-	printk(KERN_INFO"Loading PL peripheral drivers.\n");
-
-	platform_driver_register(&led_pwm_driver);
-	printk(KERN_DEBUG"PWM led driver registered.\n");
+	int i;
+	int retval;
 
-	platform_driver_register(&sw_driver);
-	printk(KERN_DEBUG"Switch driver registered.\n");
+	module_load_ns = ktime_get_ns();
+	printk(KERN_INFO"Loading PL peripheral drivers.\n");
 
-	platform_driver_register(&rng_driver);
-	printk(KERN_DEBUG"Random number generator driver registered.\n");
+	spin_lock_init(&timer_adapt.lock);
+	for(i=0;i<PERIPH_ID_NUM;i++)
+	{
+		spin_lock_init(&slots[i].lock);
+		init_waitqueue_head(&slots[i].drain_wq);
+		INIT_LIST_HEAD(&slots[i].orphans);
+		INIT_WORK(&slots[i].reap,slot_reap_worker);
+		init_waitqueue_head(&slots[i].event_wq);
+		INIT_LIST_HEAD(&slots[i].sessions);
+	}
+	session_cache = KMEM_CACHE(periph_session,0);
+	if(!session_cache)
+	{
+		printk(KERN_ERR"Cannot create the session cache.\n");
+		return -ENOMEM;
+	}
+	dd_debugfs = debugfs_create_dir("device_drivers",NULL);
+	debugfs_create_file("swap_stats",0444,dd_debugfs,NULL,&swap_stats_fops);
+	debugfs_create_file("probe_stats",0444,dd_debugfs,NULL,&probe_stats_fops);
+	debugfs_create_file("fop_stats",0644,dd_debugfs,NULL,&fop_stats_fops);
+	debugfs_create_file("cache_stats",0644,dd_debugfs,NULL,&cache_stats_fops);
+	debugfs_create_file("sessions",0444,dd_debugfs,NULL,&sessions_fops);
+	debugfs_create_file("timer_stats",0644,dd_debugfs,NULL,&timer_stats_fops);
+	debugfs_create_file("pipeline_stats",0644,dd_debugfs,NULL,&pipeline_stats_fops);
+	debugfs_create_file("mmio_trace",0644,dd_debugfs,NULL,&mmio_trace_fops);
+	if(simulate && fake_dma && fake_dma_register()) printk(KERN_ERR"Cannot register the software DMA engine.\n");
+	pipeline_init();
+	if(misc_register(&pwm_seq_miscdev)) printk(KERN_ERR"Cannot register the pl_pwm_seq device.\n");
+	else pwm_seq_registered = true;
+
+	for(i=0;i<ARRAY_SIZE(platform_drivers);i++)
+	{
+		retval = platform_driver_register(platform_drivers[i]);
+		if(retval)
+		{
+			printk(KERN_ERR"Cannot register %s driver: %d.\n",platform_drivers[i]->driver.name,retval);
+			goto err;
+		}
+		printk(KERN_DEBUG"%s driver registered.\n",platform_drivers[i]->driver.name);
+	}
 
-	platform_driver_register(&timer_driver);
-	printk(KERN_DEBUG"AXI timer driver registered.\n");
+	if(simulate) create_sim_devices();
 
+	module_init_ns = ktime_get_ns() - module_load_ns;
 	return 0;
+
+	err:
+		while(--i >= 0) platform_driver_unregister(platform_drivers[i]);
+		if(pwm_seq_registered) misc_deregister(&pwm_seq_miscdev);
+		pipeline_exit();
+		fake_dma_unregister();
+		rng_dma_free();
+		kfree(led_pwm_seq.frames);
+		debugfs_remove_recursive(dd_debugfs);
+		mmio_trace_free();
+		vfree(mmio_trace_saved);
+		kmem_cache_destroy(session_cache);
+		return retval;
 }
 
 /**
@@ -806,11 +4086,24 @@ static int __init device_drivers_init(void)
  */
 static void __exit device_drivers_exit(void)
 {
+	int i;
+
 	printk(KERN_INFO"Unloading PL peripheral drivers.\n");
-	platform_driver_unregister(&led_pwm_driver);
-	platform_driver_unregister(&sw_driver);
-	platform_driver_unregister(&rng_driver);
-	platform_driver_unregister(&timer_driver);
+	for(i=0;i<PERIPH_ID_NUM;i++)
+		if(sim_pdevs[i]) platform_device_unregister(sim_pdevs[i]);
+	for(i=ARRAY_SIZE(platform_drivers)-1;i>=0;i--)
+		platform_driver_unregister(platform_drivers[i]);
+	for(i=0;i<PERIPH_ID_NUM;i++)
+		flush_work(&slots[i].reap);
+	if(pwm_seq_registered) misc_deregister(&pwm_seq_miscdev);
+	pipeline_exit();
+	fake_dma_unregister();
+	rng_dma_free();
+	kfree(led_pwm_seq.frames);
+	debugfs_remove_recursive(dd_debugfs);
+	mmio_trace_free();
+	vfree(mmio_trace_saved);
+	kmem_cache_destroy(session_cache);
 }
 
 module_init(device_drivers_init);
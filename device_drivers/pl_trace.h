@@ -0,0 +1,74 @@
+/*
+ * pl_trace.h
+ *
+ *	Tracepoints of the peripheral events of device_drivers. BPF programs and bpftrace attach to them as
+ *	tracepoint:pl_periph:<event>, see test_scripts/pl_events.bt. Build with CFLAGS_device_drivers.o := -I$(src)
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM pl_periph
+
+#if !defined(_PL_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _PL_TRACE_H
+
+#include <linux/tracepoint.h>
+
+/**
+ * pl_timer_tick - Expiries of the AXI timer, counted by its interrupt handler or its poll.
+ * @seq: Number of expiries since the timer statistics were cleared, including these.
+ * @expiries: Expiries since the previous tick.
+ * @interval_ns: Time since the previous tick or the (re)load of the timer, 0 if unknown.
+ * @period_ns: Period of the timer. The jitter of the tick is interval_ns - expiries * period_ns.
+ * @polled: Counted by the poll, the interrupt is masked.
+ */
+TRACE_EVENT(pl_timer_tick,
+	TP_PROTO(u64 seq, u64 expiries, u64 interval_ns, u64 period_ns, bool polled),
+	TP_ARGS(seq, expiries, interval_ns, period_ns, polled),
+	TP_STRUCT__entry(
+		__field(u64, seq)
+		__field(u64, expiries)
+		__field(u64, interval_ns)
+		__field(u64, period_ns)
+		__field(bool, polled)
+	),
+	TP_fast_assign(
+		__entry->seq = seq;
+		__entry->expiries = expiries;
+		__entry->interval_ns = interval_ns;
+		__entry->period_ns = period_ns;
+		__entry->polled = polled;
+	),
+	TP_printk("seq=%llu expiries=%llu interval_ns=%llu period_ns=%llu polled=%d",__entry->seq,__entry->expiries,
+		__entry->interval_ns,__entry->period_ns,__entry->polled)
+);
+
+/**
+ * pl_input_change - Change of an input register found by the sampler, e.g. the switches.
+ * @periph_id: Peripheral ID of the device.
+ * @offset: Byte offset of the register.
+ */
+TRACE_EVENT(pl_input_change,
+	TP_PROTO(int periph_id, unsigned int offset, u32 old, u32 val),
+	TP_ARGS(periph_id, offset, old, val),
+	TP_STRUCT__entry(
+		__field(int, periph_id)
+		__field(unsigned int, offset)
+		__field(u32, old)
+		__field(u32, val)
+	),
+	TP_fast_assign(
+		__entry->periph_id = periph_id;
+		__entry->offset = offset;
+		__entry->old = old;
+		__entry->val = val;
+	),
+	TP_printk("periph_id=%d offset=%u old=0x%x val=0x%x",__entry->periph_id,__entry->offset,__entry->old,__entry->val)
+);
+
+#endif /* _PL_TRACE_H */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE pl_trace
+#include <trace/define_trace.h>
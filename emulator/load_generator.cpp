@@ -0,0 +1,156 @@
+/*
+ * load_generator.cpp
+ *
+ *	Drives a device node of the PL peripherals (real or emulated by pl_cuse) with concurrent clients,
+ *	and reports the throughput and the latency percentiles of the calls.
+ *
+ *	Build: g++ -O2 -std=c++17 -pthread load_generator.cpp -o load_generator
+ *	Usage: load_generator -d /dev/led_pwm0 [-c clients] [-t seconds] [-w value] [-r bytes] [-o]
+ *		-w value: write the value instead of reading
+ *		-r bytes: size of the reads (default 16)
+ *		-o: open and close the file for every call, like the Python scripts do
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct Options
+{
+	std::string device;
+	unsigned clients = 1;
+	double seconds = 5.0;
+	bool write = false;
+	std::string value;
+	size_t read_size = 16;
+	bool open_per_call = false;
+};
+
+struct ClientResult
+{
+	std::vector<uint32_t> latency_ns;
+	uint64_t errors = 0;
+};
+
+// One call on the device. Returns the result of the read or write.
+ssize_t do_call(int fd, const Options &opt, char *buf)
+{
+	if(opt.write)
+		return write(fd, opt.value.data(), opt.value.size());
+	return read(fd, buf, opt.read_size);
+}
+
+void client(const Options &opt, const std::atomic<bool> &stop, ClientResult &result)
+{
+	std::vector<char> buf(opt.read_size);
+	int flags = opt.write ? O_WRONLY : O_RDONLY;
+	int fd = -1;
+
+	result.latency_ns.reserve(1 << 16);
+	while(!stop.load(std::memory_order_relaxed))
+	{
+		auto start = Clock::now();
+		if(fd < 0)
+			fd = open(opt.device.c_str(), flags);
+		ssize_t ret = fd >= 0 ? do_call(fd, opt, buf.data()) : -1;
+		bool ok = ret >= 0;
+		// The text nodes return one value per open file, a new value needs a new open after the end of file.
+		if(fd >= 0 && (opt.open_per_call || (!opt.write && ret == 0)))
+		{
+			close(fd);
+			fd = -1;
+		}
+		auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+		if(!ok)
+			result.errors++;
+		else
+			result.latency_ns.push_back(static_cast<uint32_t>(std::min<int64_t>(ns, UINT32_MAX)));
+	}
+	if(fd >= 0)
+		close(fd);
+}
+
+uint32_t percentile(const std::vector<uint32_t> &sorted, double p)
+{
+	if(sorted.empty())
+		return 0;
+	size_t idx = static_cast<size_t>(p / 100.0 * (sorted.size() - 1) + 0.5);
+	return sorted[idx];
+}
+
+void usage(const char *prog)
+{
+	std::fprintf(stderr, "Usage: %s -d device [-c clients] [-t seconds] [-w value] [-r bytes] [-o]\n", prog);
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+	Options opt;
+	int c;
+
+	while((c = getopt(argc, argv, "d:c:t:w:r:o")) != -1)
+	{
+		switch(c)
+		{
+		case 'd': opt.device = optarg; break;
+		case 'c': opt.clients = std::max(1ul, std::strtoul(optarg, nullptr, 0)); break;
+		case 't': opt.seconds = std::atof(optarg); break;
+		case 'w': opt.write = true; opt.value = optarg; break;
+		case 'r': opt.read_size = std::max(1ul, std::strtoul(optarg, nullptr, 0)); break;
+		case 'o': opt.open_per_call = true; break;
+		default: usage(argv[0]); return 1;
+		}
+	}
+	if(opt.device.empty())
+	{
+		usage(argv[0]);
+		return 1;
+	}
+
+	std::atomic<bool> stop(false);
+	std::vector<ClientResult> results(opt.clients);
+	std::vector<std::thread> threads;
+
+	auto start = Clock::now();
+	for(unsigned i = 0; i < opt.clients; i++)
+		threads.emplace_back(client, std::cref(opt), std::cref(stop), std::ref(results[i]));
+	std::this_thread::sleep_for(std::chrono::duration<double>(opt.seconds));
+	stop = true;
+	for(auto &t : threads)
+		t.join();
+	double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+
+	std::vector<uint32_t> all;
+	uint64_t errors = 0;
+	for(auto &r : results)
+	{
+		all.insert(all.end(), r.latency_ns.begin(), r.latency_ns.end());
+		errors += r.errors;
+	}
+	std::sort(all.begin(), all.end());
+
+	std::printf("device:      %s (%s)\n", opt.device.c_str(), opt.write ? "write" : "read");
+	std::printf("clients:     %u\n", opt.clients);
+	std::printf("calls:       %zu (%llu errors)\n", all.size(), static_cast<unsigned long long>(errors));
+	std::printf("throughput:  %.0f calls/s\n", all.size() / elapsed);
+	std::printf("latency us:  p50 %.1f  p90 %.1f  p99 %.1f  p99.9 %.1f  max %.1f\n",
+		percentile(all, 50) / 1e3, percentile(all, 90) / 1e3, percentile(all, 99) / 1e3,
+		percentile(all, 99.9) / 1e3, all.empty() ? 0.0 : all.back() / 1e3);
+	return errors ? 2 : 0;
+}
@@ -0,0 +1,316 @@
+/*
+ * mmio_replay.cpp
+ *
+ *	Replays the register accesses recorded by the mmio_trace debugfs files of device_drivers and device_attacher,
+ *	and compares the duration of every access with the recorded one.
+ *
+ *	Record:	echo 1 > /sys/module/device_drivers/parameters/mmio_trace
+ *		(run the workload)
+ *		echo 0 > /sys/module/device_drivers/parameters/mmio_trace
+ *		cat /sys/kernel/debug/device_drivers/mmio_trace > run.trace
+ *	Replay:	mmio_replay [-m mem|model] [-f] [-n repeat] run.trace [id_reg.trace]
+ *		-m mem: accesses the registers through /dev/mem (default), the peripheral of the trace has to be loaded
+ *		-m model: accesses register models, the same as the simulation mode of the drivers
+ *		-f: replays the accesses back to back, instead of keeping the recorded gaps
+ *
+ *	Build: g++ -O2 -std=c++17 mmio_replay.cpp -o mmio_replay
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// Record of the mmio_trace debugfs files, see struct mmio_trace_rec in device_drivers.c.
+struct TraceRec
+{
+	uint64_t ns;
+	uint32_t val;
+	uint32_t dur_ns;
+	uint16_t offset;
+	uint8_t periph_id;
+	uint8_t op;
+	uint32_t cpu;
+};
+static_assert(sizeof(TraceRec) == 24, "trace record size differs from the kernel");
+
+enum { MMIO_READ32 = 0, MMIO_READ16 = 1, MMIO_WRITE32 = 2 };
+
+// Peripheral IDs above 4 are the peripherals of the generic driver.
+constexpr int PERIPH_NUM = 8;
+const char *periph_names[PERIPH_NUM] = {"id_reg", "led_pwm", "myrandom", "sw", "mytimer", "pl5", "pl6", "pl7"};
+const char *op_names[] = {"read32", "read16", "write32"};
+
+// Physical addresses of the ID register and of the peripheral region of the PL.
+constexpr off_t ID_REG_ADDR = 0x43c00000;
+constexpr off_t PERIPH_ADDR = 0x43c10000;
+
+class Target
+{
+public:
+	virtual ~Target() = default;
+	virtual uint32_t read(const TraceRec &rec) = 0;
+	virtual void write(const TraceRec &rec) = 0;
+};
+
+// Registers of the PL, mapped through /dev/mem.
+class MemTarget : public Target
+{
+public:
+	bool open()
+	{
+		fd_ = ::open("/dev/mem", O_RDWR | O_SYNC);
+		if(fd_ < 0)
+			return false;
+		id_reg_ = map(ID_REG_ADDR);
+		periph_ = map(PERIPH_ADDR);
+		return id_reg_ && periph_;
+	}
+
+	~MemTarget() override
+	{
+		if(id_reg_)
+			munmap(const_cast<uint8_t *>(id_reg_), page_size());
+		if(periph_)
+			munmap(const_cast<uint8_t *>(periph_), page_size());
+		if(fd_ >= 0)
+			close(fd_);
+	}
+
+	uint32_t read(const TraceRec &rec) override
+	{
+		volatile uint8_t *addr = base(rec) + rec.offset;
+		if(rec.op == MMIO_READ16)
+			return *reinterpret_cast<volatile uint16_t *>(addr);
+		return *reinterpret_cast<volatile uint32_t *>(addr);
+	}
+
+	void write(const TraceRec &rec) override
+	{
+		*reinterpret_cast<volatile uint32_t *>(base(rec) + rec.offset) = rec.val;
+	}
+
+private:
+	static size_t page_size() { return sysconf(_SC_PAGESIZE); }
+
+	volatile uint8_t *map(off_t addr)
+	{
+		void *p = mmap(nullptr, page_size(), PROT_READ | PROT_WRITE, MAP_SHARED, fd_, addr);
+		return p == MAP_FAILED ? nullptr : static_cast<volatile uint8_t *>(p);
+	}
+
+	volatile uint8_t *base(const TraceRec &rec) { return rec.periph_id ? periph_ : id_reg_; }
+
+	int fd_ = -1;
+	volatile uint8_t *id_reg_ = nullptr;
+	volatile uint8_t *periph_ = nullptr;
+};
+
+// Register models. Registers written by the trace read back the written value, the random number generator is the
+// LFSR of the simulation mode, and the inputs of the PL (switches, counter, ID) return the recorded value.
+class ModelTarget : public Target
+{
+public:
+	uint32_t read(const TraceRec &rec) override
+	{
+		auto &regs = regs_[rec.periph_id % PERIPH_NUM];
+		unsigned int idx = (rec.offset / 4) % 16;
+
+		if(rec.periph_id == 2)
+		{
+			lfsr_ = (lfsr_ >> 1) ^ (-(lfsr_ & 1u) & 0xB400u);
+			return lfsr_;
+		}
+		if(!written_[rec.periph_id % PERIPH_NUM][idx] || (rec.periph_id == 4 && rec.offset == 8))
+			return rec.val;
+		return regs[idx];
+	}
+
+	void write(const TraceRec &rec) override
+	{
+		unsigned int idx = (rec.offset / 4) % 16;
+
+		if(rec.periph_id == 2)
+			lfsr_ = rec.val ? rec.val : 1;
+		regs_[rec.periph_id % PERIPH_NUM][idx] = rec.val;
+		written_[rec.periph_id % PERIPH_NUM][idx] = true;
+	}
+
+private:
+	uint32_t regs_[PERIPH_NUM][16] = {};
+	bool written_[PERIPH_NUM][16] = {};
+	uint16_t lfsr_ = 1;
+};
+
+struct OpStat
+{
+	uint64_t count = 0;
+	uint64_t recorded_ns = 0;
+	uint64_t mismatches = 0;
+	std::vector<uint32_t> replayed_ns;
+};
+
+bool load(const char *path, std::vector<TraceRec> &trace)
+{
+	std::ifstream f(path, std::ios::binary);
+	TraceRec rec;
+
+	if(!f)
+		return false;
+	while(f.read(reinterpret_cast<char *>(&rec), sizeof(rec)))
+		trace.push_back(rec);
+	return true;
+}
+
+uint64_t percentile(std::vector<uint32_t> &v, double p)
+{
+	if(v.empty())
+		return 0;
+	std::sort(v.begin(), v.end());
+	return v[static_cast<size_t>(p / 100.0 * (v.size() - 1) + 0.5)];
+}
+
+void usage(const char *prog)
+{
+	std::fprintf(stderr, "Usage: %s [-m mem|model] [-f] [-n repeat] trace...\n", prog);
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+	std::string mode = "mem";
+	bool fast = false;
+	unsigned long repeat = 1;
+	int c;
+
+	while((c = getopt(argc, argv, "m:fn:")) != -1)
+	{
+		switch(c)
+		{
+		case 'm': mode = optarg; break;
+		case 'f': fast = true; break;
+		case 'n': repeat = std::max(1ul, std::strtoul(optarg, nullptr, 0)); break;
+		default: usage(argv[0]); return 1;
+		}
+	}
+	if(optind >= argc)
+	{
+		usage(argv[0]);
+		return 1;
+	}
+
+	// The traces of the modules are merged in time order.
+	std::vector<TraceRec> trace;
+	for(int i = optind; i < argc; i++)
+	{
+		if(!load(argv[i], trace))
+		{
+			std::fprintf(stderr, "Cannot read %s\n", argv[i]);
+			return 1;
+		}
+	}
+	std::stable_sort(trace.begin(), trace.end(), [](const TraceRec &a, const TraceRec &b) { return a.ns < b.ns; });
+	if(trace.empty())
+	{
+		std::fprintf(stderr, "Empty trace.\n");
+		return 1;
+	}
+
+	std::unique_ptr<Target> target;
+	if(mode == "model")
+		target.reset(new ModelTarget);
+	else
+	{
+		auto mem = new MemTarget;
+		target.reset(mem);
+		if(!mem->open())
+		{
+			std::perror("/dev/mem");
+			return 1;
+		}
+	}
+
+	OpStat stats[PERIPH_NUM][3];
+	uint64_t late_ns_total = 0, late_ns_max = 0;
+	uint64_t recorded_span = trace.back().ns - trace.front().ns;
+	auto run_start = Clock::now();
+
+	for(unsigned long r = 0; r < repeat; r++)
+	{
+		auto pass_start = Clock::now();
+		for(const auto &rec : trace)
+		{
+			if(rec.periph_id >= PERIPH_NUM || rec.op > MMIO_WRITE32)
+				continue;
+			if(!fast)
+			{
+				// Keep the recorded gaps, the lateness of the accesses shows where the replay cannot follow the trace.
+				auto due = pass_start + std::chrono::nanoseconds(rec.ns - trace.front().ns);
+				auto now = Clock::now();
+				while(now < due)
+					now = Clock::now();
+				uint64_t late = std::chrono::duration_cast<std::chrono::nanoseconds>(now - due).count();
+				late_ns_total += late;
+				late_ns_max = std::max(late_ns_max, late);
+			}
+
+			auto start = Clock::now();
+			uint32_t val = 0;
+			if(rec.op == MMIO_WRITE32)
+				target->write(rec);
+			else
+				val = target->read(rec);
+			auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+
+			OpStat &s = stats[rec.periph_id][rec.op];
+			s.count++;
+			s.recorded_ns += rec.dur_ns;
+			s.replayed_ns.push_back(static_cast<uint32_t>(std::min<int64_t>(ns, UINT32_MAX)));
+			if(rec.op != MMIO_WRITE32 && val != rec.val)
+				s.mismatches++;
+		}
+	}
+	double elapsed = std::chrono::duration<double>(Clock::now() - run_start).count();
+
+	std::printf("accesses:        %zu x %lu (%s%s)\n", trace.size(), repeat, mode.c_str(), fast ? ", back to back" : "");
+	std::printf("recorded span:   %.3f ms\n", recorded_span / 1e6);
+	std::printf("replayed span:   %.3f ms per pass\n", elapsed * 1e3 / repeat);
+	if(!fast)
+		std::printf("lateness us:     avg %.2f  max %.2f\n", late_ns_total / 1e3 / (trace.size() * repeat),
+			late_ns_max / 1e3);
+	std::printf("\n%-10s %8s %10s %14s %14s %14s %10s\n", "device", "op", "count", "recorded_ns", "replayed_ns",
+		"replayed_p99", "mismatch");
+	for(int p = 0; p < PERIPH_NUM; p++)
+	{
+		for(int o = 0; o < 3; o++)
+		{
+			OpStat &s = stats[p][o];
+			if(!s.count)
+				continue;
+			uint64_t total = 0;
+			for(auto ns : s.replayed_ns)
+				total += ns;
+			std::printf("%-10s %8s %10llu %14llu %14llu %14llu %10llu\n", periph_names[p], op_names[o],
+				static_cast<unsigned long long>(s.count), static_cast<unsigned long long>(s.recorded_ns / s.count),
+				static_cast<unsigned long long>(total / s.count),
+				static_cast<unsigned long long>(percentile(s.replayed_ns, 99)),
+				static_cast<unsigned long long>(s.mismatches));
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,355 @@
+/*
+ * pl_cuse.c
+ *
+ *	CUSE daemon emulating the character devices of the PL peripheral drivers:
+ *	/dev/sw, /dev/myrandom, /dev/mytimer, /dev/led_pwm0..7 and /dev/pl_pwm_seq.
+ *	The read and write calls return the same bytes as the functions in device_drivers.c. A duty table written to
+ *	pl_pwm_seq is not played, the channels are set to its last frame.
+ *
+ *	Build: gcc -O2 -Wall pl_cuse.c -o pl_cuse $(pkg-config --cflags --libs fuse3)
+ *	Usage: pl_cuse [-l service latency in us] [-s switch state]
+ */
+
+#define FUSE_USE_VERSION 31
+
+#include <cuse_lowlevel.h>
+#include <fuse_lowlevel.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+enum node_type {NODE_SW, NODE_RNG, NODE_TIMER, NODE_PWM, NODE_PWM_SEQ};
+
+// State of one emulated device node.
+struct node{
+	char name[16];
+	enum node_type type;
+	pthread_mutex_t lock;
+	uint32_t reg;		// Switch state, PWM channel or timer period.
+	int running;		// Timer is running.
+	uint16_t lfsr;		// State of the random number generator.
+};
+
+// Per open file data.
+struct open_file{
+	size_t pos;
+};
+
+/// Maximum number of random numbers returned by one read, as in device_drivers.c.
+#define RNG_READ_WORDS 128
+/// Number of PWM channels and the maximum number of frames of a duty table, as in device_drivers.c.
+#define PWM_CHANNELS 8
+#define PWM_SEQ_FRAMES 1024
+
+static unsigned int latency_us = 0;
+// Duty values of the PWM channels, shared by the processes of the led_pwm and pl_pwm_seq nodes.
+static uint32_t *pwm_duty;
+
+/******************************************************
+ * ***** Conversions, same as in device_drivers.c *****
+ * ****************************************************/
+
+static uint32_t str2int(const char*str,int len)
+{
+	int i;
+	uint32_t val;
+
+	for(val=0, i=0; str[i] >= '0' && str[i] <= '9' && i<len; i++)
+	{
+		val *=10;
+		val += str[i]-'0';
+	}
+	return val;
+}
+
+static int uint2str(uint32_t num, char*str,size_t len)
+{
+	int l;
+	char rev[15];
+	int i;
+	size_t digit_num;
+
+	if(num == 0)
+	{
+		rev[0] = '0';
+		l = 1;
+	}
+	else
+	for(l=0;num>0;l++)
+	{
+		rev[l] = '0' + num %10;
+		num /= 10;
+	}
+
+	if(len-1 > l)
+		digit_num = l;
+	else
+		digit_num = len-1;
+
+	for(i=0;i<digit_num;i++)
+	{
+		str[digit_num-1-i] = rev[i];
+	}
+	str[digit_num] = 0;
+
+	return digit_num+1;
+}
+
+/**
+ * reply_window - Replies the part of str at the file position, like the read functions of the drivers.
+ */
+static void reply_window(fuse_req_t req, struct open_file *of, const char *str, size_t str_len, size_t count)
+{
+	if(of->pos >= str_len)
+	{
+		fuse_reply_buf(req,NULL,0);
+		return;
+	}
+	if(of->pos + count > str_len) count = str_len - of->pos;
+	fuse_reply_buf(req,str + of->pos,count);
+	of->pos += count;
+}
+
+/******************************************************
+ * **************** CUSE operations *******************
+ * ****************************************************/
+
+static void pl_open(fuse_req_t req, struct fuse_file_info *fi)
+{
+	struct open_file *of = calloc(1,sizeof(struct open_file));
+
+	if(!of)
+	{
+		fuse_reply_err(req,ENOMEM);
+		return;
+	}
+	fi->fh = (uint64_t)(uintptr_t)of;
+	fi->direct_io = 1;
+	fi->nonseekable = 1;
+	fuse_reply_open(req,fi);
+}
+
+static void pl_release(fuse_req_t req, struct fuse_file_info *fi)
+{
+	free((void*)(uintptr_t)fi->fh);
+	fuse_reply_err(req,0);
+}
+
+static void pl_read(fuse_req_t req, size_t size, off_t off, struct fuse_file_info *fi)
+{
+	struct node *node = fuse_req_userdata(req);
+	struct open_file *of = (struct open_file*)(uintptr_t)fi->fh;
+	char str[11];
+	uint8_t words[2*RNG_READ_WORDS];
+	int i, len;
+	uint32_t val;
+
+	if(latency_us) usleep(latency_us);
+
+	pthread_mutex_lock(&node->lock);
+	switch(node->type)
+	{
+	case NODE_SW:
+		// 8 binary digits, MSB first, and the terminating zero.
+		val = node->reg;
+		for(i=0;i<8;i++)
+		{
+			str[7-i] = '0'+val%2;
+			val /= 2;
+		}
+		str[8] = 0;
+		reply_window(req,of,str,9,size);
+		break;
+	case NODE_RNG:
+		// 16 bit numbers, as many as fit, up to RNG_READ_WORDS.
+		len = size/2 < RNG_READ_WORDS ? size/2 : RNG_READ_WORDS;
+		for(i=0;i<len;i++)
+		{
+			node->lfsr = (node->lfsr >> 1) ^ (-(node->lfsr & 1u) & 0xB400u);
+			words[2*i] = node->lfsr & 0xFF;
+			words[2*i+1] = node->lfsr >> 8;
+		}
+		fuse_reply_buf(req,(const char*)words,2*len);
+		break;
+	case NODE_TIMER:
+	case NODE_PWM:
+		// Decimal number with the terminating zero.
+		val = node->type == NODE_PWM ? __atomic_load_n(&pwm_duty[node->reg],__ATOMIC_RELAXED) : node->reg;
+		len = uint2str(val,str,11);
+		reply_window(req,of,str,len,size);
+		break;
+	case NODE_PWM_SEQ:
+		// Write only
+		fuse_reply_buf(req,NULL,0);
+		break;
+	}
+	pthread_mutex_unlock(&node->lock);
+}
+
+static void pl_write(fuse_req_t req, const char *buf, size_t size, off_t off, struct fuse_file_info *fi)
+{
+	struct node *node = fuse_req_userdata(req);
+	char str[11];
+	int len;
+	uint32_t val;
+
+	if(latency_us) usleep(latency_us);
+
+	if(node->type == NODE_PWM_SEQ)
+	{
+		// Whole frames of the 8 duty values (u32), at most PWM_SEQ_FRAMES of them.
+		if(size == 0 || size % sizeof(uint32_t[PWM_CHANNELS]))
+		{
+			fuse_reply_err(req,EINVAL);
+			return;
+		}
+		if(size > PWM_SEQ_FRAMES * sizeof(uint32_t[PWM_CHANNELS]))
+		{
+			fuse_reply_err(req,EFBIG);
+			return;
+		}
+		buf += size - sizeof(uint32_t[PWM_CHANNELS]);
+		for(len=0;len<PWM_CHANNELS;len++)
+		{
+			memcpy(&val,buf + len*sizeof(val),sizeof(val));
+			__atomic_store_n(&pwm_duty[len],val,__ATOMIC_RELAXED);
+		}
+		fuse_reply_write(req,size);
+		return;
+	}
+
+	pthread_mutex_lock(&node->lock);
+	switch(node->type)
+	{
+	case NODE_SW:
+		// Not writable
+		size = 0;
+		break;
+	case NODE_RNG:
+		if(size == 0) break;
+		val = (uint8_t)buf[0];
+		if(size > 1) val |= (uint8_t)buf[1] << 8;
+		node->lfsr = val ? val : 1;
+		break;
+	case NODE_TIMER:
+	case NODE_PWM:
+		len = size>10?10:size;
+		memcpy(str,buf,len);
+		str[len] = 0;
+		val = str2int(str,len);
+		if(node->type == NODE_PWM)
+			__atomic_store_n(&pwm_duty[node->reg],val,__ATOMIC_RELAXED);
+		else if(val < 100000)
+			node->running = 0;
+		else
+		{
+			node->reg = val;
+			node->running = 1;
+		}
+		break;
+	default:
+		break;
+	}
+	pthread_mutex_unlock(&node->lock);
+	fuse_reply_write(req,size);
+}
+
+static const struct cuse_lowlevel_ops pl_ops = {
+	.open = pl_open,
+	.release = pl_release,
+	.read = pl_read,
+	.write = pl_write,
+};
+
+/**
+ * run_node - Serves one device node until the daemon is stopped.
+ */
+static int run_node(const char *prog, struct node *node)
+{
+	char dev_name[32];
+	const char *dev_info_argv[] = {dev_name};
+	char *argv[] = {(char*)prog, "-f", NULL};
+	struct cuse_info ci;
+
+	snprintf(dev_name,sizeof(dev_name),"DEVNAME=%s",node->name);
+	memset(&ci,0,sizeof(ci));
+	ci.dev_info_argc = 1;
+	ci.dev_info_argv = dev_info_argv;
+
+	pthread_mutex_init(&node->lock,NULL);
+	return cuse_lowlevel_main(2,argv,&ci,&pl_ops,node);
+}
+
+int main(int argc, char *argv[])
+{
+	int opt, i, n = 0;
+	uint32_t switches = 0;
+	pid_t pids[12];
+	struct node nodes[12];
+
+	while((opt = getopt(argc,argv,"l:s:")) != -1)
+	{
+		switch(opt)
+		{
+		case 'l': latency_us = strtoul(optarg,NULL,0); break;
+		case 's': switches = strtoul(optarg,NULL,0); break;
+		default:
+			fprintf(stderr,"Usage: %s [-l service latency in us] [-s switch state]\n",argv[0]);
+			return 1;
+		}
+	}
+
+	// Mapped before the fork, the nodes of the channels and of the duty tables see the same values.
+	pwm_duty = mmap(NULL,PWM_CHANNELS*sizeof(uint32_t),PROT_READ|PROT_WRITE,MAP_SHARED|MAP_ANONYMOUS,-1,0);
+	if(pwm_duty == MAP_FAILED)
+	{
+		perror("mmap");
+		return 1;
+	}
+
+	memset(nodes,0,sizeof(nodes));
+	strcpy(nodes[n].name,"sw");
+	nodes[n].type = NODE_SW;
+	nodes[n++].reg = switches;
+	strcpy(nodes[n].name,"myrandom");
+	nodes[n].type = NODE_RNG;
+	nodes[n++].lfsr = 1;
+	strcpy(nodes[n].name,"mytimer");
+	nodes[n++].type = NODE_TIMER;
+	for(i=0;i<PWM_CHANNELS;i++)
+	{
+		snprintf(nodes[n].name,sizeof(nodes[n].name),"led_pwm%d",i);
+		nodes[n].type = NODE_PWM;
+		nodes[n++].reg = i;
+	}
+	strcpy(nodes[n].name,"pl_pwm_seq");
+	nodes[n++].type = NODE_PWM_SEQ;
+
+	// CUSE serves one device per session, every node gets its own process.
+	for(i=0;i<n;i++)
+	{
+		pids[i] = fork();
+		if(pids[i] < 0)
+		{
+			perror("fork");
+			n = i;
+			break;
+		}
+		if(pids[i] == 0) return run_node(argv[0],&nodes[i]);
+	}
+
+	// Stop all nodes, when one of them exits.
+	wait(NULL);
+	for(i=0;i<n;i++) kill(pids[i],SIGTERM);
+	while(wait(NULL) > 0);
+	return 0;
+}
@@ -0,0 +1,413 @@
+/*
+ * plperiph.cpp
+ *
+ *	C++ client library of the PL peripheral drivers.
+ */
+
+#include "plperiph.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <cmath>
+#include <stdexcept>
+#include <system_error>
+#include <thread>
+#include <utility>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+namespace plperiph {
+
+namespace {
+
+[[noreturn]] void throw_errno(const std::string &what)
+{
+	throw std::system_error(errno, std::generic_category(), what);
+}
+
+// Longest text value of the nodes: 10 digits and the terminating zero.
+constexpr size_t TEXT_LEN = 11;
+
+} // namespace
+
+/******************************************************
+ * ********************** File ************************
+ * ****************************************************/
+
+File::File(const std::string &path, int flags) : path_(path)
+{
+	fd_ = ::open(path.c_str(), flags | O_CLOEXEC);
+	if(fd_ < 0)
+		throw_errno(path);
+}
+
+File::~File()
+{
+	if(fd_ >= 0)
+		::close(fd_);
+}
+
+File::File(File &&other) noexcept : fd_(std::exchange(other.fd_, -1)), path_(std::move(other.path_))
+{
+}
+
+File &File::operator=(File &&other) noexcept
+{
+	if(this != &other)
+	{
+		if(fd_ >= 0)
+			::close(fd_);
+		fd_ = std::exchange(other.fd_, -1);
+		path_ = std::move(other.path_);
+	}
+	return *this;
+}
+
+size_t File::read_text(char *buf, size_t len) const
+{
+	ssize_t ret = ::pread(fd_, buf, len, 0);
+	if(ret < 0)
+		throw_errno(path_);
+	return ret;
+}
+
+size_t File::read_raw(void *buf, size_t len) const
+{
+	ssize_t ret = ::read(fd_, buf, len);
+	if(ret < 0)
+		throw_errno(path_);
+	return ret;
+}
+
+void File::write_raw(const void *buf, size_t len) const
+{
+	if(::write(fd_, buf, len) < 0)
+		throw_errno(path_);
+}
+
+uint32_t File::read_u32() const
+{
+	char buf[TEXT_LEN];
+	uint32_t val = 0;
+	size_t len = read_text(buf, sizeof(buf));
+
+	std::from_chars(buf, buf + len, val);
+	return val;
+}
+
+void File::write_u32(uint32_t val) const
+{
+	char buf[TEXT_LEN];
+	auto res = std::to_chars(buf, buf + sizeof(buf), val);
+	write_raw(buf, res.ptr - buf);
+}
+
+/******************************************************
+ * ******************* Peripherals ********************
+ * ****************************************************/
+
+Switches::Switches(const std::string &path) : file_(path, O_RDONLY)
+{
+}
+
+uint8_t Switches::read() const
+{
+	// 8 binary digits, MSB first.
+	char buf[9];
+	size_t len = file_.read_text(buf, sizeof(buf));
+	uint8_t val = 0;
+
+	for(size_t i = 0; i < std::min<size_t>(len, 8); i++)
+		val = (val << 1) | (buf[i] == '1');
+	return val;
+}
+
+Random::Random(const std::string &path) : file_(path, O_RDWR)
+{
+}
+
+uint16_t Random::read() const
+{
+	uint16_t val = 0;
+	file_.read_raw(&val, sizeof(val));
+	return val;
+}
+
+void Random::read(uint16_t *buf, size_t count) const
+{
+	// The driver may return less numbers than asked for.
+	size_t done = 0;
+	while(done < count)
+	{
+		size_t ret = file_.read_raw(buf + done, (count - done) * sizeof(uint16_t));
+		if(ret < sizeof(uint16_t))
+			throw std::system_error(EIO, std::generic_category(), file_.path());
+		done += ret / sizeof(uint16_t);
+	}
+}
+
+void Random::seed(uint16_t seed) const
+{
+	file_.write_raw(&seed, sizeof(seed));
+}
+
+Timer::Timer(const std::string &path) : file_(path, O_RDWR)
+{
+}
+
+uint32_t Timer::period() const
+{
+	return file_.read_u32();
+}
+
+void Timer::start(uint32_t period_cycles) const
+{
+	file_.write_u32(std::max(period_cycles, TIMER_MIN_PERIOD));
+}
+
+void Timer::stop() const
+{
+	file_.write_u32(0);
+}
+
+Pwm::Pwm(const std::string &path_base, const std::string &seq_path) : seq_path_(seq_path)
+{
+	for(unsigned i = 0; i < PWM_CHANNELS; i++)
+		ch_[i] = File(path_base + std::to_string(i), O_RDWR);
+	written_.fill(UINT32_MAX);
+}
+
+uint32_t Pwm::get(unsigned ch) const
+{
+	return ch_.at(ch).read_u32();
+}
+
+void Pwm::set(unsigned ch, uint32_t duty)
+{
+	ch_.at(ch).write_u32(duty);
+	written_[ch] = duty;
+}
+
+void Pwm::set_level(unsigned ch, double level)
+{
+	set(ch, static_cast<uint32_t>(std::lround(std::clamp(level, 0.0, 1.0) * PWM_MAX_DUTY)));
+}
+
+Pwm::Batch &Pwm::Batch::set(unsigned ch, uint32_t duty)
+{
+	if(ch >= PWM_CHANNELS)
+		throw std::out_of_range("PWM channel");
+	duty_[ch] = duty;
+	pending_ |= 1u << ch;
+	return *this;
+}
+
+Pwm::Batch &Pwm::Batch::set_all(uint32_t duty)
+{
+	duty_.fill(duty);
+	pending_ = (1u << PWM_CHANNELS) - 1;
+	return *this;
+}
+
+unsigned Pwm::Batch::commit()
+{
+	unsigned changed = 0;
+	unsigned writes = 0;
+
+	for(unsigned i = 0; i < PWM_CHANNELS; i++)
+		if((pending_ & (1u << i)) && pwm_.written_[i] != duty_[i])
+			changed |= 1u << i;
+	pending_ = 0;
+	if(!changed)
+		return 0;
+
+	// A single channel is written as text, more of them as one binary frame of the 8 duty values.
+	if(__builtin_popcount(changed) == 1)
+	{
+		unsigned ch = __builtin_ctz(changed);
+		pwm_.set(ch, duty_[ch]);
+		return 1;
+	}
+	std::array<uint32_t, PWM_CHANNELS> frame;
+	for(unsigned i = 0; i < PWM_CHANNELS; i++)
+	{
+		if(changed & (1u << i))
+		{
+			frame[i] = duty_[i];
+			writes++;
+		}
+		else
+			frame[i] = pwm_.written_[i] != UINT32_MAX ? pwm_.written_[i] : pwm_.get(i);
+	}
+	pwm_.set_frame(frame);
+	return writes;
+}
+
+void Pwm::set_frame(const std::array<uint32_t, PWM_CHANNELS> &duty)
+{
+	if(seq_.fd() < 0)
+		seq_ = File(seq_path_, O_WRONLY);
+	seq_.write_raw(duty.data(), sizeof(uint32_t) * PWM_CHANNELS);
+	written_ = duty;
+}
+
+/******************************************************
+ * ******************* Event loop *********************
+ * ****************************************************/
+
+EventLoop::EventLoop()
+{
+	epfd_ = epoll_create1(EPOLL_CLOEXEC);
+	if(epfd_ < 0)
+		throw_errno("epoll_create1");
+}
+
+EventLoop::~EventLoop()
+{
+	::close(epfd_);
+}
+
+void EventLoop::add(int fd, std::function<void()> handler)
+{
+	// Edge triggered: the drivers report an error while the peripheral is swapped out, it is delivered once.
+	struct epoll_event ev = {};
+	ev.events = EPOLLIN | EPOLLET;
+	ev.data.fd = fd;
+	if(epoll_ctl(epfd_, EPOLL_CTL_ADD, fd, &ev) < 0)
+		throw_errno("epoll_ctl");
+	handlers_[fd] = std::move(handler);
+}
+
+void EventLoop::watch(const Timer &timer, std::function<void()> on_tick)
+{
+	// The read marks the event as seen by the file.
+	add(timer.file().fd(), [&timer, on_tick]() {
+		timer.period();
+		on_tick();
+	});
+}
+
+void EventLoop::watch(const Switches &sw, std::function<void(uint8_t)> on_change)
+{
+	// A polled file gets the queued changes one by one, all of them are read before waiting for the next edge.
+	add(sw.file().fd(), [&sw, on_change]() {
+		struct pollfd pfd = {sw.file().fd(), POLLIN, 0};
+		do
+			on_change(sw.read());
+		while(::poll(&pfd, 1, 0) > 0 && (pfd.revents & POLLIN));
+	});
+}
+
+void EventLoop::unwatch(int fd)
+{
+	epoll_ctl(epfd_, EPOLL_CTL_DEL, fd, nullptr);
+	handlers_.erase(fd);
+}
+
+int EventLoop::run_once(std::chrono::milliseconds timeout)
+{
+	struct epoll_event events[16];
+	int n = epoll_wait(epfd_, events, 16, static_cast<int>(timeout.count()));
+
+	if(n < 0)
+	{
+		if(errno == EINTR)
+			return 0;
+		throw_errno("epoll_wait");
+	}
+	for(int i = 0; i < n; i++)
+	{
+		auto it = handlers_.find(events[i].data.fd);
+		if(it == handlers_.end() || !(events[i].events & EPOLLIN))
+			continue;
+		try
+		{
+			it->second();
+		}
+		catch(const std::system_error &e)
+		{
+			// Swapped out since the event, the next event comes after the peripheral is back.
+			if(e.code().value() != EAGAIN)
+				throw;
+		}
+	}
+	return n;
+}
+
+void EventLoop::run()
+{
+	running_ = true;
+	while(running_)
+		run_once();
+}
+
+/******************************************************
+ * ********************** Lease ***********************
+ * ****************************************************/
+
+std::string Lease::node_of(const std::string &name)
+{
+	if(name == "pwm" || name == "1")
+		return "/dev/led_pwm0";
+	if(name == "random" || name == "2")
+		return "/dev/myrandom";
+	if(name == "sw" || name == "3")
+		return "/dev/sw";
+	if(name == "timer" || name == "4")
+		return "/dev/mytimer";
+	throw std::invalid_argument("unknown peripheral " + name);
+}
+
+Lease::Lease(const std::string &name, std::chrono::milliseconds timeout, const std::string &attacher)
+	: attacher_(attacher, O_RDWR)
+{
+	auto deadline = std::chrono::steady_clock::now() + timeout;
+	std::string node = node_of(name);
+	char buf[TEXT_LEN];
+
+	// Blocks until the peripheral is granted and programmed.
+	attacher_.write_raw(name.data(), name.size());
+
+	// The drivers are probed asynchronously, the device file appears and becomes usable shortly after the grant.
+	for(;;)
+	{
+		int fd = ::open(node.c_str(), O_RDONLY | O_CLOEXEC);
+		if(fd >= 0)
+		{
+			ssize_t ret = ::read(fd, buf, sizeof(buf));
+			::close(fd);
+			if(ret >= 0)
+				return;
+		}
+		if(errno != ENOENT && errno != ENODEV && errno != ENXIO && errno != EAGAIN)
+			throw_errno(node);
+		if(std::chrono::steady_clock::now() > deadline)
+			throw std::system_error(ETIMEDOUT, std::generic_category(), node);
+		std::this_thread::sleep_for(std::chrono::microseconds(200));
+	}
+}
+
+Lease::~Lease()
+{
+	try
+	{
+		release();
+	}
+	catch(const std::system_error &)
+	{
+	}
+}
+
+void Lease::release()
+{
+	if(attacher_.fd() < 0)
+		return;
+	attacher_.write_raw("done", 4);
+	attacher_ = File();
+}
+
+} // namespace plperiph
@@ -0,0 +1,210 @@
+/*
+ * plperiph.h
+ *
+ *	C++ client library of the PL peripheral drivers. The device files are kept open by the handles, the values are
+ *	converted without string streams, and the timer and switch events are delivered by an epoll loop.
+ *
+ *	Build: g++ -O2 -std=c++17 -c plperiph.cpp && ar rcs libplperiph.a plperiph.o
+ *
+ *	Example:
+ *		plperiph::Lease lease("pwm");		// Waits for the PWM peripheral, released at the end of the scope.
+ *		plperiph::Pwm pwm;
+ *		pwm.batch().set(0, 50000).set(7, 100000).commit();
+ */
+
+#ifndef PLPERIPH_H_
+#define PLPERIPH_H_
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <string>
+
+namespace plperiph {
+
+// Number of channels of the PWM peripheral.
+constexpr unsigned PWM_CHANNELS = 8;
+// Duty value of the full brightness of a PWM channel.
+constexpr uint32_t PWM_MAX_DUTY = 100000;
+// Default timer_min_period of device_drivers, the timer does not start with smaller periods.
+constexpr uint32_t TIMER_MIN_PERIOD = 100000;
+
+/**
+ * File - Open device file. The errors of the calls are thrown as std::system_error.
+ */
+class File
+{
+public:
+	File() = default;
+	File(const std::string &path, int flags);
+	~File();
+	File(File &&other) noexcept;
+	File &operator=(File &&other) noexcept;
+	File(const File &) = delete;
+	File &operator=(const File &) = delete;
+
+	int fd() const { return fd_; }
+	const std::string &path() const { return path_; }
+
+	// Reads the text value of the node from its beginning. The drivers do not support seeking, pread is used.
+	size_t read_text(char *buf, size_t len) const;
+	size_t read_raw(void *buf, size_t len) const;
+	void write_raw(const void *buf, size_t len) const;
+
+	// Decimal values, as used by the timer and PWM nodes.
+	uint32_t read_u32() const;
+	void write_u32(uint32_t val) const;
+
+private:
+	int fd_ = -1;
+	std::string path_;
+};
+
+/**
+ * Switches - /dev/sw, the state of the 8 switches.
+ */
+class Switches
+{
+public:
+	explicit Switches(const std::string &path = "/dev/sw");
+	uint8_t read() const;
+	const File &file() const { return file_; }
+
+private:
+	File file_;
+};
+
+/**
+ * Random - /dev/myrandom, 16 bit random numbers.
+ */
+class Random
+{
+public:
+	explicit Random(const std::string &path = "/dev/myrandom");
+	uint16_t read() const;
+	// Fills the buffer with random numbers.
+	void read(uint16_t *buf, size_t count) const;
+	void seed(uint16_t seed) const;
+
+private:
+	File file_;
+};
+
+/**
+ * Timer - /dev/mytimer, the AXI timer. The period is given in cycles of the 100 MHz clock, shorter periods than
+ * TIMER_MIN_PERIOD are raised to it.
+ */
+class Timer
+{
+public:
+	explicit Timer(const std::string &path = "/dev/mytimer");
+	uint32_t period() const;
+	void start(uint32_t period_cycles) const;
+	void stop() const;
+	const File &file() const { return file_; }
+
+private:
+	File file_;
+};
+
+/**
+ * Pwm - /dev/led_pwm0..7, the duty values of the PWM channels. The frames are written to /dev/pl_pwm_seq.
+ */
+class Pwm
+{
+public:
+	// Channel values collected and written together by commit.
+	class Batch
+	{
+	public:
+		explicit Batch(Pwm &pwm) : pwm_(pwm) {}
+		Batch &set(unsigned ch, uint32_t duty);
+		Batch &set_all(uint32_t duty);
+		// Writes the channels, whose value differs from the last written one: one channel as text, more of them as one
+		// binary frame. Returns the number of channels changed.
+		unsigned commit();
+
+	private:
+		Pwm &pwm_;
+		std::array<uint32_t, PWM_CHANNELS> duty_ {};
+		uint32_t pending_ = 0;	// Bit mask of the set channels.
+	};
+
+	explicit Pwm(const std::string &path_base = "/dev/led_pwm", const std::string &seq_path = "/dev/pl_pwm_seq");
+	uint32_t get(unsigned ch) const;
+	void set(unsigned ch, uint32_t duty);
+	// Sets the channel to the fraction of the full brightness, 0.0 .. 1.0.
+	void set_level(unsigned ch, double level);
+	Batch batch() { return Batch(*this); }
+	// Writes all the channels by one binary frame of the 8 duty values (u32), with a single write call to the sequence
+	// node. The node is opened at the first frame.
+	void set_frame(const std::array<uint32_t, PWM_CHANNELS> &duty);
+
+private:
+	std::array<File, PWM_CHANNELS> ch_;
+	File seq_;
+	std::string seq_path_;
+	std::array<uint32_t, PWM_CHANNELS> written_;	// Last written values, UINT32_MAX if unknown.
+};
+
+/**
+ * EventLoop - Delivers the timer interrupts and the switch changes. The switch changes are reported only if the
+ * cache_sample_ms parameter of device_drivers is set, each of them in order, as long as the driver still queues it.
+ */
+class EventLoop
+{
+public:
+	EventLoop();
+	~EventLoop();
+	EventLoop(const EventLoop &) = delete;
+	EventLoop &operator=(const EventLoop &) = delete;
+
+	// The handle has to live while it is watched.
+	void watch(const Timer &timer, std::function<void()> on_tick);
+	void watch(const Switches &sw, std::function<void(uint8_t)> on_change);
+	void unwatch(int fd);
+
+	// Waits for the events and calls their callbacks. Returns the number of events, 0 on timeout.
+	int run_once(std::chrono::milliseconds timeout = std::chrono::milliseconds(-1));
+	// Runs until stop is called from a callback.
+	void run();
+	void stop() { running_ = false; }
+
+private:
+	void add(int fd, std::function<void()> handler);
+
+	int epfd_ = -1;
+	bool running_ = false;
+	std::map<int, std::function<void()>> handlers_;
+};
+
+/**
+ * Lease - Requests a peripheral from device_attacher, and waits until its device file can be used. The peripheral is
+ * released when the lease is destroyed.
+ * @name: Peripheral name or ID, as accepted by /dev/device_attacher: "pwm", "random", "sw" or "timer".
+ */
+class Lease
+{
+public:
+	explicit Lease(const std::string &name,
+		std::chrono::milliseconds timeout = std::chrono::milliseconds(5000),
+		const std::string &attacher = "/dev/device_attacher");
+	~Lease();
+	Lease(Lease &&other) noexcept = default;
+	Lease(const Lease &) = delete;
+	Lease &operator=(const Lease &) = delete;
+
+	void release();
+	// Device file, that becomes available with the peripheral.
+	static std::string node_of(const std::string &name);
+
+private:
+	File attacher_;
+};
+
+} // namespace plperiph
+
+#endif /* PLPERIPH_H_ */
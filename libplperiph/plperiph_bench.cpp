@@ -0,0 +1,126 @@
+/*
+ * plperiph_bench.cpp
+ *
+ *	Compares the library handles with the open/format/write/close pattern of the Python scripts.
+ *	Works with the real peripherals, the simulated ones (device_drivers.ko simulate=1) and the CUSE emulator.
+ *
+ *	Build: g++ -O2 -std=c++17 plperiph_bench.cpp plperiph.cpp -o plperiph_bench
+ *	Usage: plperiph_bench [iterations]
+ */
+
+#include "plperiph.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <string>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+double ns_per_op(unsigned long n, const std::function<void(unsigned long)> &op)
+{
+	auto start = Clock::now();
+	for(unsigned long i = 0; i < n; i++)
+		op(i);
+	return std::chrono::duration<double, std::nano>(Clock::now() - start).count() / n;
+}
+
+// One write, the way the scripts do it.
+void naive_write(const std::string &path, uint32_t val)
+{
+	char buf[16];
+	int len = std::snprintf(buf, sizeof(buf), "%u", val);
+	int fd = open(path.c_str(), O_WRONLY);
+	if(fd < 0)
+		return;
+	if(write(fd, buf, len) < 0)
+		std::perror(path.c_str());
+	close(fd);
+}
+
+uint32_t naive_read(const std::string &path)
+{
+	char buf[16] = {};
+	int fd = open(path.c_str(), O_RDONLY);
+	if(fd < 0)
+		return 0;
+	if(read(fd, buf, sizeof(buf) - 1) < 0)
+		std::perror(path.c_str());
+	close(fd);
+	return std::strtoul(buf, nullptr, 10);
+}
+
+void report(const char *name, double naive, double lib)
+{
+	std::printf("%-22s %12.0f %12.0f %8.1fx\n", name, naive, lib, naive / lib);
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+	unsigned long n = argc > 1 ? std::strtoul(argv[1], nullptr, 0) : 10000;
+
+	std::printf("%-22s %12s %12s %9s\n", "operation", "naive_ns", "library_ns", "speedup");
+	if(access("/dev/led_pwm0", F_OK) == 0)
+	{
+		plperiph::Pwm pwm;
+
+		report("pwm write",
+			ns_per_op(n, [](unsigned long i) { naive_write("/dev/led_pwm0", i % plperiph::PWM_MAX_DUTY); }),
+			ns_per_op(n, [&](unsigned long i) { pwm.set(0, i % plperiph::PWM_MAX_DUTY); }));
+
+		// All channels change, like a frame of the fade of thesis.py.
+		report("pwm 8 channel frame",
+			ns_per_op(n, [](unsigned long i) {
+				for(unsigned ch = 0; ch < plperiph::PWM_CHANNELS; ch++)
+					naive_write("/dev/led_pwm" + std::to_string(ch), (i + ch) % plperiph::PWM_MAX_DUTY);
+			}),
+			ns_per_op(n, [&](unsigned long i) {
+				auto batch = pwm.batch();
+				for(unsigned ch = 0; ch < plperiph::PWM_CHANNELS; ch++)
+					batch.set(ch, (i + ch) % plperiph::PWM_MAX_DUTY);
+				batch.commit();
+			}));
+
+		// Only one channel changes per frame, the batch skips the others.
+		report("pwm sparse frame",
+			ns_per_op(n, [](unsigned long i) {
+				for(unsigned ch = 0; ch < plperiph::PWM_CHANNELS; ch++)
+					naive_write("/dev/led_pwm" + std::to_string(ch), ch == i % 8 ? i % plperiph::PWM_MAX_DUTY : 0);
+			}),
+			ns_per_op(n, [&](unsigned long i) {
+				auto batch = pwm.batch();
+				for(unsigned ch = 0; ch < plperiph::PWM_CHANNELS; ch++)
+					batch.set(ch, ch == i % 8 ? i % plperiph::PWM_MAX_DUTY : 0);
+				batch.commit();
+			}));
+
+		report("pwm read",
+			ns_per_op(n, [](unsigned long) { naive_read("/dev/led_pwm0"); }),
+			ns_per_op(n, [&](unsigned long) { pwm.get(0); }));
+	}
+	if(access("/dev/sw", F_OK) == 0)
+	{
+		plperiph::Switches sw;
+
+		report("sw read",
+			ns_per_op(n, [](unsigned long) { naive_read("/dev/sw"); }),
+			ns_per_op(n, [&](unsigned long) { sw.read(); }));
+	}
+	if(access("/dev/mytimer", F_OK) == 0)
+	{
+		plperiph::Timer timer;
+
+		report("timer read",
+			ns_per_op(n, [](unsigned long) { naive_read("/dev/mytimer"); }),
+			ns_per_op(n, [&](unsigned long) { timer.period(); }));
+	}
+	return 0;
+}
@@ -1,7 +1,10 @@
 #!/bin/bash
+set -e
 mkdir -p build
 dtc -I dts -O dtb -o ./build/axi_pwm.dtbo -@ pwm.dts
 dtc -I dts -O dtb -o ./build/axi_random.dtbo -@ random.dts
 dtc -I dts -O dtb -o ./build/axi_sw.dtbo -@ sw.dts
 dtc -I dts -O dtb -o ./build/axi_timer.dtbo -@ timer.dts
-dtc -I dts -O dtb -o ./build/axi_id_reg.dtbo -@ id_reg.dts
\ No newline at end of file
+dtc -I dts -O dtb -o ./build/axi_id_reg.dtbo -@ id_reg.dts
+dtc -I dts -O dtb -o ./build/generic_sw.dtbo -@ generic_sw.dts
+dtc -I dts -O dtb -o ./build/generic_pwm.dtbo -@ generic_pwm.dts
@@ -0,0 +1,56 @@
+#!/bin/sh
+# Loads the sample BPF filter (pl_events.bt) against the simulated peripherals and drives the events it filters:
+# switch changes, timer ticks and simulated swaps. Needs bpftrace and a kernel with BPF tracepoint support (4.7+).
+# Usage: bpf_events.sh <directory of the .ko files> [seconds]
+
+MODULES=${1:-.}
+SECONDS_RUN=${2:-5}
+SCRIPTS=$(dirname "$0")
+PARAMS=/sys/module/device_drivers/parameters
+OUT=/tmp/pl_events.out
+
+mount -t debugfs none /sys/kernel/debug 2>/dev/null
+insmod "$MODULES/device_drivers.ko" simulate=1 cache_sample_ms=1 || exit 1
+insmod "$MODULES/device_attacher.ko" simulate=1 sim_swap_ms=5 || exit 1
+
+bpftrace "$SCRIPTS/pl_events.bt" 129 10 200 > $OUT 2>&1 &
+BPF=$!
+# wait for the probes to be attached, at most 10 s
+n=0
+while ! grep -q Attaching $OUT 2>/dev/null; do
+    n=$((n+1))
+    if [ $n -gt 100 ] || ! kill -0 $BPF 2>/dev/null; then
+        echo "FAIL: bpftrace did not start"
+        cat $OUT
+        kill $BPF 2>/dev/null
+        rmmod device_attacher
+        rmmod device_drivers
+        exit 1
+    fi
+    sleep 0.1
+done
+
+# timer ticks every 1 ms
+echo 100000 > /dev/mytimer
+end=$(($(date +%s) + SECONDS_RUN))
+while [ $(date +%s) -lt $end ]; do
+    for sw in 1 128 129 0; do
+        echo $sw > $PARAMS/sim_switches
+        sleep 0.05
+    done
+    echo sw > /dev/device_attacher
+    echo pwm > /dev/device_attacher
+done
+echo 0 > /dev/mytimer
+
+kill -INT $BPF
+wait $BPF
+cat $OUT
+
+rmmod device_attacher
+rmmod device_drivers
+
+# the pattern 0x81 (129) was set in every round, it has to be delivered
+grep -q "switches .* -> 81" $OUT || { echo "FAIL: switch pattern not delivered"; exit 1; }
+grep -q "@ticks" $OUT || { echo "FAIL: timer ticks not counted"; exit 1; }
+echo "ok"
@@ -0,0 +1,79 @@
+import os
+import sys
+import time
+import multiprocessing
+
+# Register reads of 64 concurrent readers of a device, with and without the register cache.
+# Works with the real peripherals and with the simulated ones:
+#   insmod device_drivers.ko simulate=1
+# Usage: cache_bench.py [device] [max age in us] [seconds]
+
+READERS = 64
+DEVICE = sys.argv[1] if len(sys.argv) > 1 else "/dev/sw"
+MAX_AGE_US = sys.argv[2] if len(sys.argv) > 2 else "1000"
+SECONDS = float(sys.argv[3]) if len(sys.argv) > 3 else 5.0
+
+PARAM = "/sys/module/device_drivers/parameters/cache_max_age_us"
+STATS = "/sys/kernel/debug/device_drivers/cache_stats"
+# peripheral IDs of the device nodes
+IDS = {"led_pwm": 1, "myrandom": 2, "sw": 3, "mytimer": 4}
+
+def device_name(path):
+    for name in IDS:
+        if os.path.basename(path).startswith(name):
+            return name
+    raise ValueError("unknown device " + path)
+
+def set_max_age(i, us):
+    with open(PARAM) as f:
+        ages = f.read().strip().split(",")
+    ages[i] = str(us)
+    with open(PARAM, "w") as f:
+        f.write(",".join(ages))
+
+def mmio_reads(name):
+    with open(STATS) as f:
+        for line in f:
+            cols = line.split()
+            if cols[0] == name:
+                return int(cols[3])
+    return 0
+
+# Reads the device until the deadline, returns the number of reads in the queue.
+def reader(path, deadline, queue):
+    n = 0
+    fd = os.open(path, os.O_RDONLY)
+    while time.time() < deadline:
+        if hasattr(os, "pread"):
+            os.pread(fd, 16, 0)
+        else:
+            os.close(fd)
+            fd = os.open(path, os.O_RDONLY)
+            os.read(fd, 16)
+        n += 1
+    os.close(fd)
+    queue.put(n)
+
+def run(name, age):
+    set_max_age(IDS[name], age)
+    with open(STATS, "w") as f:
+        f.write("0")
+    queue = multiprocessing.Queue()
+    deadline = time.time() + SECONDS
+    procs = [multiprocessing.Process(target=reader, args=(DEVICE, deadline, queue)) for i in range(READERS)]
+    start = time.time()
+    for p in procs:
+        p.start()
+    reads = sum(queue.get() for p in procs)
+    for p in procs:
+        p.join()
+    elapsed = time.time() - start
+    mmio = mmio_reads(name)
+    print("%-10s %10d %12d %14d" % (age, reads / elapsed, mmio / elapsed, reads / max(mmio, 1)))
+
+name = device_name(DEVICE)
+print("%d readers of %s for %.0f s" % (READERS, DEVICE, SECONDS))
+print("%-10s %10s %12s %14s" % ("max_age_us", "reads/s", "mmio_reads/s", "reads_per_mmio"))
+run(name, 0)
+run(name, MAX_AGE_US)
+set_max_age(IDS[name], 0)
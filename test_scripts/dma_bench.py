@@ -0,0 +1,80 @@
+import os
+import sys
+import time
+import struct
+
+# Bulk transfers by DMA against the register accesses of the CPU: random number reads and PWM duty tables.
+# Needs the DMA channels in the overlays, or the simulation mode with the software DMA engine:
+#   insmod device_drivers.ko simulate=1 fake_dma=1 fop_stats=1
+# Usage: dma_bench.py [seconds per case]
+
+SECONDS = float(sys.argv[1]) if len(sys.argv) > 1 else 2.0
+
+PARAMS = "/sys/module/device_drivers/parameters/"
+STATS = "/sys/kernel/debug/device_drivers/fop_stats"
+RNG = "/dev/myrandom"
+PWM = "/dev/led_pwm0"
+PWM_SEQ = "/dev/pl_pwm_seq"
+READ_SIZES = [256, 1024, 4096, 16384]
+SEQ_FRAMES = [1, 16, 256, 1024]
+
+def set_param(name, val):
+    with open(PARAMS + name, "w") as f:
+        f.write(str(val))
+
+def get_param(name):
+    with open(PARAMS + name) as f:
+        return f.read().strip()
+
+# Returns the calls and bytes per second of the function, called until the time is up.
+def measure(func):
+    calls = 0
+    total = 0
+    start = time.time()
+    while time.time() - start < SECONDS:
+        total += func()
+        calls += 1
+    elapsed = time.time() - start
+    return calls / elapsed, total / elapsed
+
+def bench_rng(size):
+    fd = os.open(RNG, os.O_RDONLY)
+    try:
+        return measure(lambda: len(os.read(fd, size)))
+    finally:
+        os.close(fd)
+
+def bench_pwm(frames):
+    # ramp of all 8 channels
+    table = b"".join(struct.pack("<8I", *[i * 100000 // frames] * 8) for i in range(frames))
+    fd = os.open(PWM_SEQ, os.O_WRONLY)
+    try:
+        return measure(lambda: os.write(fd, table))
+    finally:
+        os.close(fd)
+
+old_dma = get_param("use_dma")
+old_step = get_param("pwm_seq_step_us")
+# the frames are written back to back
+set_param("pwm_seq_step_us", 0)
+
+print("%-10s %6s %8s %12s %14s" % ("device", "dma", "size", "calls/s", "bytes/s"))
+try:
+    for dma in ("N", "Y"):
+        set_param("use_dma", dma)
+        if os.path.exists(RNG):
+            for size in READ_SIZES:
+                calls, rate = bench_rng(size)
+                print("%-10s %6s %8d %12.0f %14.0f" % ("myrandom", dma, size, calls, rate))
+        if os.path.exists(PWM):
+            for frames in SEQ_FRAMES:
+                calls, rate = bench_pwm(frames)
+                print("%-10s %6s %8d %12.0f %14.0f" % ("led_pwm", dma, frames * 32, calls, rate))
+finally:
+    set_param("use_dma", old_dma)
+    set_param("pwm_seq_step_us", old_step)
+
+print("")
+print("Kernel side:")
+with open(STATS) as f:
+    sys.stdout.write(f.read())
@@ -0,0 +1,64 @@
+import os
+import sys
+import time
+
+# Micro-benchmark of the file operations of the PL peripheral drivers.
+# Works with the real peripherals and with the simulated ones:
+#   insmod device_drivers.ko simulate=1 fop_stats=1
+
+N = 10000
+STATS = "/sys/kernel/debug/device_drivers/fop_stats"
+
+# The drivers have no llseek, every read starts from offset 0 with pread,
+# or with a new open file where pread is not available (python 2).
+def bench_read(path, size):
+    start = time.time()
+    if hasattr(os, "pread"):
+        fd = os.open(path, os.O_RDONLY)
+        for i in range(N):
+            os.pread(fd, size, 0)
+        os.close(fd)
+    else:
+        for i in range(N):
+            fd = os.open(path, os.O_RDONLY)
+            os.read(fd, size)
+            os.close(fd)
+    return time.time() - start
+
+def bench_write(path, data):
+    fd = os.open(path, os.O_WRONLY)
+    start = time.time()
+    for i in range(N):
+        os.write(fd, data)
+    elapsed = time.time() - start
+    os.close(fd)
+    return elapsed
+
+CASES = [
+    ("sw", "read", "/dev/sw", 9),
+    ("myrandom", "read", "/dev/myrandom", 2),
+    ("myrandom", "write", "/dev/myrandom", b"\x01\x01"),
+    ("mytimer", "read", "/dev/mytimer", 11),
+    ("mytimer", "write", "/dev/mytimer", b"100000000"),
+    ("led_pwm", "read", "/dev/led_pwm0", 11),
+    ("led_pwm", "write", "/dev/led_pwm0", b"50000"),
+]
+
+# clear the kernel side statistics
+with open(STATS, "w") as f:
+    f.write("0")
+
+print("%-10s %6s %12s %12s" % ("device", "op", "ns_per_op", "ops_per_sec"))
+for dev, op, path, arg in CASES:
+    if not os.path.exists(path):
+        continue
+    if op == "read":
+        elapsed = bench_read(path, arg)
+    else:
+        elapsed = bench_write(path, arg)
+    print("%-10s %6s %12d %12d" % (dev, op, elapsed * 1e9 / N, N / elapsed))
+
+print("")
+print("Kernel side:")
+with open(STATS) as f:
+    sys.stdout.write(f.read())
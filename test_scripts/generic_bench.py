@@ -0,0 +1,71 @@
+import os
+import sys
+import time
+import struct
+
+# Compares the hand-written drivers with the generic PL driver on the same peripherals.
+# Benchmarks the device nodes present: load the overlays of overlays/generic_*.dts or the ones of the own drivers,
+# see generic_bench.sh. Works with the real peripherals and with the simulated ones:
+#   insmod device_drivers.ko simulate=1 sim_devices=0 fop_stats=1
+# The generic devices are accessed by offset, needs pread and pwrite (python 3).
+
+N = 10000
+STATS = "/sys/kernel/debug/device_drivers/fop_stats"
+
+def bench_pread(path, size):
+    fd = os.open(path, os.O_RDONLY)
+    start = time.time()
+    for i in range(N):
+        os.pread(fd, size, 0)
+    elapsed = time.time() - start
+    os.close(fd)
+    return elapsed
+
+def bench_pwrite(path, data):
+    fd = os.open(path, os.O_WRONLY)
+    start = time.time()
+    for i in range(N):
+        os.pwrite(fd, data, 0)
+    elapsed = time.time() - start
+    os.close(fd)
+    return elapsed
+
+# All 8 PWM channels, one write per channel device.
+def bench_channels(path_base, data):
+    fds = [os.open(path_base + str(ch), os.O_WRONLY) for ch in range(8)]
+    start = time.time()
+    for i in range(N):
+        for fd in fds:
+            os.pwrite(fd, data, 0)
+    elapsed = time.time() - start
+    for fd in fds:
+        os.close(fd)
+    return elapsed
+
+DUTY = 50000
+CASES = [
+    ("sw", "read", "/dev/sw", lambda p: bench_pread(p, 9)),
+    ("generic_sw", "read", "/dev/generic_sw", lambda p: bench_pread(p, 4)),
+    ("led_pwm", "read", "/dev/led_pwm0", lambda p: bench_pread(p, 11)),
+    ("generic_pwm", "read", "/dev/generic_pwm", lambda p: bench_pread(p, 4)),
+    ("led_pwm", "write", "/dev/led_pwm0", lambda p: bench_pwrite(p, str(DUTY).encode())),
+    ("generic_pwm", "write", "/dev/generic_pwm", lambda p: bench_pwrite(p, struct.pack("<I", DUTY))),
+    ("led_pwm", "all8", "/dev/led_pwm7", lambda p: bench_channels(p[:-1], str(DUTY).encode())),
+    ("generic_pwm", "all8", "/dev/generic_pwm", lambda p: bench_pwrite(p, struct.pack("<8I", *[DUTY] * 8))),
+]
+
+# clear the kernel side statistics
+with open(STATS, "w") as f:
+    f.write("0")
+
+print("%-12s %6s %12s %12s" % ("device", "op", "ns_per_op", "ops_per_sec"))
+for dev, op, path, bench in CASES:
+    if not os.path.exists(path):
+        continue
+    elapsed = bench(path)
+    print("%-12s %6s %12d %12d" % (dev, op, elapsed * 1e9 / N, N / elapsed))
+
+print("")
+print("Kernel side:")
+with open(STATS) as f:
+    sys.stdout.write(f.read())
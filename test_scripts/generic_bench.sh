@@ -0,0 +1,62 @@
+#!/bin/sh
+# Compares the own drivers of the switch and PWM peripherals with the generic PL driver, without the PL.
+# The same peripheral is loaded first with its own overlay, then with the overlay of the generic driver.
+# The ID register and the peripherals are simulated, the overlays are applied for real.
+# Usage: generic_bench.sh <directory of the .ko files>
+
+MODULES=${1:-.}
+FW=/lib/firmware
+SCRIPTS=$(dirname "$0")
+BUILD="$SCRIPTS/../overlays/build"
+
+(cd "$SCRIPTS/../overlays" && sh compile_dev_tree_frag.sh) || exit 1
+mkdir -p $FW
+# the fake FPGA manager accepts any bitstream
+for bit in my_axi_pwm my_axi_sw; do
+    [ -f $FW/$bit.bit ] || head -c 4045564 /dev/zero > $FW/$bit.bit
+done
+
+mount -t debugfs none /sys/kernel/debug 2>/dev/null
+insmod "$MODULES/device_drivers.ko" simulate=1 sim_devices=0 fop_stats=1 || exit 1
+
+# wait_for <path>: polls every 10 ms, gives up after 5 s
+wait_for() {
+    n=0
+    while [ ! -e "$1" ]; do
+        n=$((n+1))
+        if [ $n -gt 500 ]; then
+            echo "Timeout waiting for $1" >&2
+            return 1
+        fi
+        sleep 0.01
+    done
+}
+
+fail() {
+    rmmod device_attacher 2>/dev/null
+    rmmod device_drivers
+    exit 1
+}
+
+# run <peripheral> <ID> <overlay> <device node>
+# The device attacher caches the overlays, it is reloaded for every overlay.
+run() {
+    cp "$BUILD/$3" $FW/dev_$2.dtbo
+    insmod "$MODULES/device_attacher.ko" sim_id_reg=1 fake_fpga_mgr=1 || fail
+    echo $1 > /dev/device_attacher
+    wait_for $4 || fail
+    echo "$1 with $3:"
+    python3 "$SCRIPTS/generic_bench.py"
+    echo
+    rmmod device_attacher
+}
+
+run sw 3 axi_sw.dtbo /dev/sw
+run sw 3 generic_sw.dtbo /dev/generic_sw
+run pwm 1 axi_pwm.dtbo /dev/led_pwm7
+run pwm 1 generic_pwm.dtbo /dev/generic_pwm
+
+# the overlays of the own drivers are left in place
+cp "$BUILD/axi_sw.dtbo" $FW/dev_3.dtbo
+cp "$BUILD/axi_pwm.dtbo" $FW/dev_1.dtbo
+rmmod device_drivers
@@ -0,0 +1,53 @@
+import struct
+import sys
+import time
+
+# Checks the switch to PWM pipeline of device_drivers with the simulated peripherals:
+#   insmod device_drivers.ko simulate=1 sim_devices=0x1A
+# A bar graph table is uploaded: n switches on light the first n channels. The timer ticks at the given period.
+# Usage: pipeline_test.py [timer period in cycles] [seconds per switch state]
+
+PERIOD = sys.argv[1] if len(sys.argv) > 1 else "100000"
+SETTLE = float(sys.argv[2]) if len(sys.argv) > 2 else 0.05
+
+PARAMS = "/sys/module/device_drivers/parameters/"
+STATS = "/sys/kernel/debug/device_drivers/pipeline_stats"
+MAX_DUTY = 100000
+
+def set_param(name, val):
+    with open(PARAMS + name, "w") as f:
+        f.write(str(val))
+
+def bar(n):
+    return [MAX_DUTY if ch < n else 0 for ch in range(8)]
+
+def duty(ch):
+    with open("/dev/led_pwm%d" % ch) as f:
+        return int(f.read().strip("\0\n"))
+
+# 256 rows of 8 u32 duty values, indexed by the state of the switches.
+lut = b"".join(struct.pack("<8I", *bar(bin(sw).count("1"))) for sw in range(256))
+with open("/dev/pl_pipeline", "wb") as f:
+    f.write(lut)
+with open(STATS, "w") as f:
+    f.write("0")
+
+set_param("pipeline_enable", 1)
+with open("/dev/mytimer", "w") as f:
+    f.write(PERIOD)
+
+failed = 0
+for sw in [0x00, 0x01, 0x81, 0x0F, 0xFF, 0x55, 0x00]:
+    set_param("sim_switches", sw)
+    time.sleep(SETTLE)
+    got = [duty(ch) for ch in range(8)]
+    ok = got == bar(bin(sw).count("1"))
+    failed += not ok
+    print("switches %02x -> %s %s" % (sw, " ".join("%6d" % d for d in got), "ok" if ok else "FAIL"))
+
+with open("/dev/mytimer", "w") as f:
+    f.write("0")
+set_param("pipeline_enable", 0)
+with open(STATS) as f:
+    sys.stdout.write(f.read())
+sys.exit(1 if failed else 0)
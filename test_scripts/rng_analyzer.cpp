@@ -0,0 +1,344 @@
+/*
+ * rng_analyzer.cpp
+ *
+ *	Streaming quality and throughput analyzer of /dev/myrandom, the replacement of thesis_random_tester.py.
+ *	The device is read at full rate with large reads, and the statistics are updated in one pass over every buffer:
+ *	bit bias, runs, chi-square of the byte values and the autocorrelation of the bits at lags 1..16.
+ *	Works with the real peripheral, the simulated one (device_drivers.ko simulate=1), the CUSE emulator, and recorded
+ *	streams (-d file, or -d /dev/stdin).
+ *
+ *	Build: g++ -O2 -std=c++17 rng_analyzer.cpp -o rng_analyzer (add -mfpu=neon on the Zynq)
+ *	Usage: rng_analyzer [-d device] [-t seconds] [-b buffer bytes] [-s seed] [-r min bytes/s] [-z max |z|]
+ *			[-w baseline file] [-c baseline file]
+ *		-w saves the throughput, -c flags a throughput more than 10% below the saved one.
+ *	Exit status is 2, if a statistic or the throughput is flagged.
+ */
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#ifdef __ARM_NEON
+#include <arm_neon.h>
+#endif
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr int MAX_LAG = 16;
+
+/**
+ * BitStats - Running statistics of the bit stream. The bits of a byte are taken LSB first.
+ */
+class BitStats
+{
+public:
+	// The length has to be a multiple of 8 bytes.
+	void update(const uint8_t *buf, size_t len)
+	{
+		histogram(buf, len);
+		ones_ += count_ones(buf, len);
+
+		// Transitions and lagged mismatches, 64 bits at a time, with the previous word for the boundary.
+		size_t words = len / 8;
+		for(size_t i = 0; i < words; i++)
+		{
+			uint64_t x;
+			std::memcpy(&x, buf + 8 * i, 8);
+			if(bits_)
+				transitions_ += ((prev_ >> 63) ^ x) & 1;
+			transitions_ += __builtin_popcountll((x ^ (x >> 1)) & 0x7FFFFFFFFFFFFFFFull);
+			for(int k = 1; k <= MAX_LAG; k++)
+			{
+				uint64_t shifted = (x << k) | (prev_ >> (64 - k));
+				uint64_t diff = x ^ shifted;
+				// The first k bits of the stream have no pair.
+				if(bits_ == 0)
+					diff &= ~0ull << k;
+				mismatches_[k] += __builtin_popcountll(diff);
+			}
+			prev_ = x;
+			bits_ += 64;
+		}
+	}
+
+	uint64_t bits() const { return bits_; }
+	uint64_t bytes() const { return bytes_; }
+
+	// Bias of the ones from 1/2, as z-score.
+	double bias_z() const
+	{
+		if(!bits_)
+			return 0;
+		return (2.0 * ones_ - bits_) / std::sqrt(static_cast<double>(bits_));
+	}
+
+	double ones_ratio() const { return bytes_ ? static_cast<double>(ones_) / (8 * bytes_) : 0; }
+
+	// Wald-Wolfowitz runs test of the bits, as z-score.
+	double runs_z() const
+	{
+		double n = bits_, n1 = ones_, n0 = n - n1;
+		if(n < 2 || n1 == 0 || n0 == 0)
+			return 0;
+		double runs = transitions_ + 1;
+		double mean = 2 * n1 * n0 / n + 1;
+		double var = 2 * n1 * n0 * (2 * n1 * n0 - n) / (n * n * (n - 1));
+		return (runs - mean) / std::sqrt(var);
+	}
+
+	// Chi-square of the byte values with 255 degrees of freedom, and its z-score by the Wilson-Hilferty transform.
+	double chi_square() const
+	{
+		if(!bytes_)
+			return 0;
+		double expected = bytes_ / 256.0, chi = 0;
+		for(int v = 0; v < 256; v++)
+		{
+			uint64_t o = hist_[0][v] + hist_[1][v] + hist_[2][v] + hist_[3][v];
+			chi += (o - expected) * (o - expected) / expected;
+		}
+		return chi;
+	}
+
+	double chi_square_z() const
+	{
+		const double k = 255;
+		return (std::cbrt(chi_square() / k) - (1 - 2 / (9 * k))) / std::sqrt(2 / (9 * k));
+	}
+
+	// Autocorrelation of the bits at the lag, as z-score of the agreeing pairs.
+	double autocorr_z(int lag) const
+	{
+		double pairs = bits_ > static_cast<uint64_t>(lag) ? bits_ - lag : 0;
+		if(pairs == 0)
+			return 0;
+		return (pairs - 2.0 * mismatches_[lag]) / std::sqrt(pairs);
+	}
+
+	int worst_lag() const
+	{
+		int worst = 1;
+		for(int k = 2; k <= MAX_LAG; k++)
+			if(std::fabs(autocorr_z(k)) > std::fabs(autocorr_z(worst)))
+				worst = k;
+		return worst;
+	}
+
+private:
+	void histogram(const uint8_t *buf, size_t len)
+	{
+		// Four interleaved histograms, the consecutive increments do not depend on each other.
+		size_t i = 0;
+		for(; i + 4 <= len; i += 4)
+		{
+			hist_[0][buf[i]]++;
+			hist_[1][buf[i + 1]]++;
+			hist_[2][buf[i + 2]]++;
+			hist_[3][buf[i + 3]]++;
+		}
+		for(; i < len; i++)
+			hist_[0][buf[i]]++;
+		bytes_ += len;
+	}
+
+	static uint64_t count_ones(const uint8_t *buf, size_t len)
+	{
+		uint64_t ones = 0;
+		size_t i = 0;
+#ifdef __ARM_NEON
+		// 16 bytes per step, the byte counts are accumulated in 16 bit lanes before they could overflow.
+		while(i + 16 <= len)
+		{
+			uint16x8_t acc = vdupq_n_u16(0);
+			for(int j = 0; j < 255 && i + 16 <= len; j++, i += 16)
+				acc = vpadalq_u8(acc, vcntq_u8(vld1q_u8(buf + i)));
+			uint64x2_t sum = vpaddlq_u32(vpaddlq_u16(acc));
+			ones += vgetq_lane_u64(sum, 0) + vgetq_lane_u64(sum, 1);
+		}
+#else
+		for(; i + 8 <= len; i += 8)
+		{
+			uint64_t x;
+			std::memcpy(&x, buf + i, 8);
+			ones += __builtin_popcountll(x);
+		}
+#endif
+		for(; i < len; i++)
+			ones += __builtin_popcount(buf[i]);
+		return ones;
+	}
+
+	uint64_t hist_[4][256] = {};
+	uint64_t ones_ = 0;
+	uint64_t bits_ = 0;
+	uint64_t bytes_ = 0;
+	uint64_t transitions_ = 0;
+	uint64_t mismatches_[MAX_LAG + 1] = {};
+	uint64_t prev_ = 0;
+};
+
+struct Options
+{
+	std::string device = "/dev/myrandom";
+	double seconds = 10;
+	size_t buffer = 1 << 16;
+	long seed = -1;
+	double min_rate = 0;
+	double max_z = 5;
+	std::string save_baseline;
+	std::string compare_baseline;
+};
+
+void usage(const char *prog)
+{
+	std::fprintf(stderr, "Usage: %s [-d device] [-t seconds] [-b buffer bytes] [-s seed] [-r min bytes/s] [-z max |z|]"
+		" [-w baseline] [-c baseline]\n", prog);
+}
+
+void print_line(double elapsed, const BitStats &s, double rate)
+{
+	int lag = s.worst_lag();
+	std::printf("%8.1f %12.0f %10.6f %8.2f %8.2f %10.1f %8.2f %4d %8.2f\n", elapsed, rate, s.ones_ratio(), s.bias_z(),
+		s.runs_z(), s.chi_square(), s.chi_square_z(), lag, s.autocorr_z(lag));
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+	Options opt;
+	int c;
+
+	while((c = getopt(argc, argv, "d:t:b:s:r:z:w:c:")) != -1)
+	{
+		switch(c)
+		{
+		case 'd': opt.device = optarg; break;
+		case 't': opt.seconds = std::atof(optarg); break;
+		case 'b': opt.buffer = std::max(16ul, std::strtoul(optarg, nullptr, 0) & ~7ul); break;
+		case 's': opt.seed = std::strtol(optarg, nullptr, 0); break;
+		case 'r': opt.min_rate = std::atof(optarg); break;
+		case 'z': opt.max_z = std::atof(optarg); break;
+		case 'w': opt.save_baseline = optarg; break;
+		case 'c': opt.compare_baseline = optarg; break;
+		default: usage(argv[0]); return 1;
+		}
+	}
+
+	int fd = open(opt.device.c_str(), opt.seed >= 0 ? O_RDWR : O_RDONLY);
+	if(fd < 0)
+	{
+		std::perror(opt.device.c_str());
+		return 1;
+	}
+	if(opt.seed >= 0)
+	{
+		uint16_t seed = opt.seed;
+		if(write(fd, &seed, 2) != 2)
+			std::perror("seed");
+	}
+
+	std::vector<uint8_t> buf(opt.buffer);
+	BitStats stats;
+	auto start = Clock::now(), last_print = start;
+	double elapsed = 0;
+	uint64_t last_bytes = 0;
+
+	std::printf("%8s %12s %10s %8s %8s %10s %8s %4s %8s\n", "time_s", "bytes/s", "ones", "bias_z", "runs_z", "chi2",
+		"chi2_z", "lag", "acorr_z");
+	bool eof = false;
+	while(elapsed < opt.seconds && !eof)
+	{
+		// Fill the buffer, the driver returns at most a few hundred bytes per read. Recorded streams end with EOF.
+		size_t filled = 0;
+		while(filled < buf.size())
+		{
+			ssize_t ret = read(fd, buf.data() + filled, buf.size() - filled);
+			if(ret < 0)
+			{
+				std::perror(opt.device.c_str());
+				return 1;
+			}
+			if(ret == 0)
+			{
+				eof = true;
+				break;
+			}
+			filled += ret;
+		}
+		stats.update(buf.data(), filled & ~7ul);
+
+		auto now = Clock::now();
+		elapsed = std::chrono::duration<double>(now - start).count();
+		double since = std::chrono::duration<double>(now - last_print).count();
+		if(since >= 1.0)
+		{
+			print_line(elapsed, stats, (stats.bytes() - last_bytes) / since);
+			last_print = now;
+			last_bytes = stats.bytes();
+		}
+	}
+	close(fd);
+
+	double rate = stats.bytes() / elapsed;
+	std::printf("\ntotal: %llu bytes in %.1f s, %.0f bytes/s\n", static_cast<unsigned long long>(stats.bytes()),
+		elapsed, rate);
+	print_line(elapsed, stats, rate);
+
+	// Regression checks
+	bool flagged = false;
+	auto check = [&](const char *name, double z) {
+		if(std::fabs(z) > opt.max_z)
+		{
+			std::printf("FLAG: %s z-score %.2f exceeds %.1f\n", name, z, opt.max_z);
+			flagged = true;
+		}
+	};
+	check("bit bias", stats.bias_z());
+	check("runs", stats.runs_z());
+	check("chi-square", stats.chi_square_z());
+	for(int k = 1; k <= MAX_LAG; k++)
+	{
+		std::string name = "autocorrelation lag " + std::to_string(k);
+		check(name.c_str(), stats.autocorr_z(k));
+	}
+	if(opt.min_rate > 0 && rate < opt.min_rate)
+	{
+		std::printf("FLAG: throughput %.0f bytes/s is below %.0f\n", rate, opt.min_rate);
+		flagged = true;
+	}
+	if(!opt.compare_baseline.empty())
+	{
+		double base = 0;
+		FILE *f = std::fopen(opt.compare_baseline.c_str(), "r");
+		if(f && std::fscanf(f, "bytes_per_sec %lf", &base) == 1 && rate < 0.9 * base)
+		{
+			std::printf("FLAG: throughput %.0f bytes/s is more than 10%% below the baseline %.0f\n", rate, base);
+			flagged = true;
+		}
+		if(f)
+			std::fclose(f);
+	}
+	if(!opt.save_baseline.empty())
+	{
+		FILE *f = std::fopen(opt.save_baseline.c_str(), "w");
+		if(f)
+		{
+			std::fprintf(f, "bytes_per_sec %.0f\n", rate);
+			std::fclose(f);
+		}
+	}
+	return flagged ? 2 : 0;
+}
@@ -0,0 +1,38 @@
+import os
+import random
+import sys
+import threading
+import time
+
+# Drives the reconfiguration scheduler of the device attacher with several clients.
+# Load the module in simulation mode first:
+#   insmod device_attacher.ko simulate=1 sim_swap_ms=20 prestage_idle_ms=0
+# The pre-staged peripherals are swapped in sim_staged_swap_ms, see the pre-staging statistics.
+
+CLIENTS = 8
+REQUESTS = 50
+PERIPHERALS = ["sw", "pwm", "random", "timer"]
+
+def client(num):
+    rnd = random.Random(num)
+    fd = os.open("/dev/device_attacher", os.O_WRONLY)
+    for i in range(REQUESTS):
+        # every request is followed by a short operation on the granted peripheral
+        os.write(fd, rnd.choice(PERIPHERALS).encode())
+        time.sleep(0.001)
+        os.write(fd, b"done")
+    os.close(fd)
+
+start = time.time()
+threads = [threading.Thread(target=client, args=(i,)) for i in range(CLIENTS)]
+for t in threads:
+    t.start()
+for t in threads:
+    t.join()
+
+print("%d requests served in %.2f s" % (CLIENTS * REQUESTS, time.time() - start))
+with open("/sys/kernel/debug/device_attacher/sched_stats") as f:
+    sys.stdout.write(f.read())
+print("")
+with open("/sys/kernel/debug/device_attacher/prestage_stats") as f:
+    sys.stdout.write(f.read())
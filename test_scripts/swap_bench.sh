@@ -0,0 +1,81 @@
+#!/bin/sh
+# End-to-end reconfiguration and I/O benchmark without the PL, e.g. on the QEMU Zynq machine.
+# The ID register and the peripherals are simulated, the overlays are applied for real.
+# Usage: swap_bench.sh <directory of the .ko files> [number of swaps] [idle seconds between the swaps]
+# The idle time lets the device attacher pre-stage the next peripheral, 0 measures the swaps without it.
+
+MODULES=${1:-.}
+SWAPS=${2:-20}
+IDLE=${3:-0.2}
+FW=/lib/firmware
+SCRIPTS=$(dirname "$0")
+
+# overlays, as named by the device attacher
+(cd "$SCRIPTS/../overlays" && sh compile_dev_tree_frag.sh) || exit 1
+mkdir -p $FW
+cp "$SCRIPTS/../overlays/build/axi_pwm.dtbo" $FW/dev_1.dtbo
+cp "$SCRIPTS/../overlays/build/axi_random.dtbo" $FW/dev_2.dtbo
+cp "$SCRIPTS/../overlays/build/axi_sw.dtbo" $FW/dev_3.dtbo
+cp "$SCRIPTS/../overlays/build/axi_timer.dtbo" $FW/dev_4.dtbo
+# the fake FPGA manager accepts any bitstream
+for bit in my_axi_pwm my_axi_rng my_axi_sw my_axi_timer; do
+    [ -f $FW/$bit.bit ] || head -c 4045564 /dev/zero > $FW/$bit.bit
+done
+
+mount -t debugfs none /sys/kernel/debug 2>/dev/null
+insmod "$MODULES/device_drivers.ko" simulate=1 sim_devices=0 fop_stats=1 || exit 1
+insmod "$MODULES/device_attacher.ko" sim_id_reg=1 fake_fpga_mgr=1 bitstream=my_axi_pwm.bit,my_axi_rng.bit,my_axi_sw.bit,my_axi_timer.bit || exit 1
+
+# wait_for <path>: polls every 10 ms, gives up after 5 s
+wait_for() {
+    n=0
+    while [ ! -e "$1" ]; do
+        n=$((n+1))
+        if [ $n -gt 500 ]; then
+            echo "Timeout waiting for $1" >&2
+            return 1
+        fi
+        sleep 0.01
+    done
+}
+
+fail() {
+    rmmod device_attacher
+    rmmod device_drivers
+    exit 1
+}
+
+# alternate the switch and pwm peripherals, like thesis.py
+i=0
+while [ $i -lt $SWAPS ]; do
+    echo sw > /dev/device_attacher
+    wait_for /dev/sw || fail
+    sleep $IDLE
+    echo pwm > /dev/device_attacher
+    wait_for /dev/led_pwm7 || fail
+    sleep $IDLE
+    i=$((i+1))
+done
+
+echo "Swap latency:"
+cat /sys/kernel/debug/device_attacher/swap_stats
+echo
+echo "Pre-staging:"
+cat /sys/kernel/debug/device_attacher/prestage_stats
+echo
+cat /sys/kernel/debug/device_drivers/swap_stats
+echo
+cat /sys/kernel/debug/device_drivers/probe_stats
+echo
+
+# per device throughput, every peripheral loaded in turn
+for dev in sw:/dev/sw random:/dev/myrandom timer:/dev/mytimer pwm:/dev/led_pwm7; do
+    echo ${dev%%:*} > /dev/device_attacher
+    wait_for ${dev#*:} || fail
+    echo "I/O of ${dev%%:*}:"
+    python "$SCRIPTS/fop_bench.py"
+    echo
+done
+
+rmmod device_attacher
+rmmod device_drivers
@@ -0,0 +1,81 @@
+import os
+import sys
+import time
+
+# CPU cost of the timer against its expiry rate, with interrupts only and with the adaptive interrupt/polling mode.
+# Works with the real timer and with the simulated one (the model of the simulated timer costs CPU as well):
+#   insmod device_drivers.ko simulate=1
+# Usage: timer_rate_sweep.py [poll rate threshold] [seconds per step]
+
+THRESHOLD = int(sys.argv[1]) if len(sys.argv) > 1 else 2000
+SECONDS = float(sys.argv[2]) if len(sys.argv) > 2 else 3.0
+
+DEVICE = "/dev/mytimer"
+PARAMS = "/sys/module/device_drivers/parameters/"
+STATS = "/sys/kernel/debug/device_drivers/timer_stats"
+CLK_HZ = 100000000
+# periods in clock cycles, 100 .. 50000 expiries per second
+PERIODS = [1000000, 200000, 100000, 50000, 20000, 10000, 5000, 2000]
+BAR = 40
+
+def set_param(name, val):
+    with open(PARAMS + name, "w") as f:
+        f.write(str(val))
+
+def get_param(name):
+    with open(PARAMS + name) as f:
+        return f.read().strip()
+
+def timer_stats():
+    stats = {}
+    with open(STATS) as f:
+        for line in f:
+            key, val = line.split(":")
+            stats[key] = val.strip()
+    return stats
+
+# busy and total jiffies of all CPUs
+def cpu_times():
+    with open("/proc/stat") as f:
+        cols = [int(c) for c in f.readline().split()[1:]]
+    idle = cols[3] + cols[4]
+    return sum(cols) - idle, sum(cols)
+
+def set_period(period):
+    fd = os.open(DEVICE, os.O_WRONLY)
+    os.write(fd, str(period).encode())
+    os.close(fd)
+
+def run(mode, threshold, period):
+    set_param("timer_poll_rate", threshold)
+    set_period(period)
+    # let the mode settle before measuring
+    time.sleep(0.2)
+    with open(STATS, "w") as f:
+        f.write("0")
+    busy0, total0 = cpu_times()
+    start = time.time()
+    time.sleep(SECONDS)
+    stats = timer_stats()
+    elapsed = time.time() - start
+    busy1, total1 = cpu_times()
+    cpu = 100.0 * (busy1 - busy0) / max(total1 - total0, 1)
+    expected = CLK_HZ / (period + 2.0)
+    counted = int(stats["expiries"]) / elapsed
+    print("%-9s %9d %10.0f %10.0f %7.3f %5s %10s %8s %6.2f |%s" % (mode, period, expected, counted,
+          counted / expected, stats["mode"], stats["irqs"], stats["polls"], cpu, "#" * int(cpu * BAR / 100)))
+
+old_min = get_param("timer_min_period")
+old_rate = get_param("timer_poll_rate")
+set_param("timer_min_period", min(PERIODS))
+
+print("%-9s %9s %10s %10s %7s %5s %10s %8s %6s" % ("mode", "period", "expected/s", "counted/s", "ratio", "now",
+      "irqs", "polls", "cpu_%"))
+try:
+    for period in PERIODS:
+        run("irq", 0, period)
+        run("adaptive", THRESHOLD, period)
+finally:
+    set_period(0)
+    set_param("timer_min_period", old_min)
+    set_param("timer_poll_rate", old_rate)